@@ -23,14 +23,26 @@
 #define LOG_TAG "audio_route"
 /*#define LOG_NDEBUG 0*/
 
+#include <ctype.h>
 #include <errno.h>
 #include <expat.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <tinyalsa/asoundlib.h>
 
+#include <audio_route/audio_route.h>
+
 #include <syslog.h>
 #define ALOGE(fmt, arg...) syslog (LOG_ERR, fmt, ##arg)
 #define ALOGI(fmt, arg...) syslog (LOG_INFO, fmt, ##arg)
@@ -38,9 +50,27 @@
 #define ALOGV(fmt, arg...) syslog (LOG_NOTICE, fmt, ##arg)
 #define ALOGW(fmt, arg...) syslog (LOG_NOTICE, fmt, ##arg)
 
-#define BUF_SIZE 1024
+/* the mapped mixer XML is handed to expat this much at a time */
+#define XML_CHUNK_SIZE (1024 * 1024)
 #define MIXER_XML_PATH "/system/etc/mixer_paths.xml"
 #define INITIAL_MIXER_PATH_SIZE 8
+#define INITIAL_NAME_INDEX_SIZE 64
+#define ARENA_BLOCK_SIZE 16384
+#define CTL_LOCK_STRIPES 256
+#define SWITCH_SHARED_BUF_SIZE 256
+/* controls of a path set listed without allocating */
+#define PATH_SET_CTLS_BUF_SIZE 256
+/* arrays this large are written from the first to the last changed value */
+#define DELTA_WRITE_MIN_SIZE 256
+#define ROUTE_CACHE_MAGIC 0x43545241 /* "ARTC" */
+#define ROUTE_SNAPSHOT_MAGIC 0x53545241 /* "ARTS" */
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+#define ROUTE_CACHE_VERSION 2
+#define ROUTE_CACHE_ALIGN 8
+#define TRACE_BUF_SIZE 256
+#define REF_DUMP_HOLDERS 16
+#define TRACE_MARKER_PATH "/sys/kernel/tracing/trace_marker"
+#define TRACE_MARKER_DEBUGFS_PATH "/sys/kernel/debug/tracing/trace_marker"
 
 enum update_direction {
     DIRECTION_FORWARD,
@@ -55,17 +85,39 @@ union ctl_values {
     unsigned char *bytes;
 };
 
+/* how a control is written, resolved from its type and the backend */
+enum ctl_write_kind {
+    CTL_WRITE_NONE,     /* unsupported type */
+    CTL_WRITE_VALUE,    /* enum, first value only */
+    CTL_WRITE_ARRAY,    /* all values */
+    CTL_WRITE_RANGE,    /* all values, or the changed span of INT and BYTE arrays */
+};
+
 struct mixer_state {
     struct mixer_ctl *ctl;
     unsigned int num_values;
     union ctl_values old_value;
     union ctl_values new_value;
     union ctl_values reset_value;
+    /* mixer value when the control was first queued in a transaction */
+    union ctl_values committed_value;
     unsigned int active_count;
+    /* cached from the mixer; value_size is 0 for unsupported types */
+    enum mixer_ctl_type type;
+    size_t value_size;
+    /* enum ctl_write_kind, and enum audio_route_write_mode */
+    uint8_t write_kind;
+    uint8_t write_mode;
+    /* old_value holds the mixer value, read on first use */
+    bool loaded;
+    /* enum name lookup, built on first use */
+    struct enum_table *enums;
 };
 
 struct mixer_setting {
     unsigned int ctl_index;
+    /* first value set, only initial settings cover part of a control */
+    unsigned int index;
     unsigned int num_values;
     unsigned int type;
     union ctl_values value;
@@ -75,38 +127,404 @@ struct mixer_value {
     unsigned int ctl_index;
     int index;
     long value;
-    /*
-     memory pointed by this is allocated in start_tag during parsing ctl of
-     MIXER_CTL_TYPE_BYTE or MIXER_CTL_TYPE_INT, and is released after the
-     parsed values are updated to either setting value within a path,
-     or top level initial setting value
-     */
-    long *values;
+    /* all values of a MIXER_CTL_TYPE_BYTE or MIXER_CTL_TYPE_INT ctl, in the
+       parse buffer of config_parse_state */
+    union ctl_values values;
+};
+
+/* write size bytes at offset in the path values to a control */
+struct path_op {
+    unsigned int ctl_index;
+    unsigned int size;
+    size_t offset;
 };
 
+/*
+ * A path is built from settings while parsing, then sealed into a program
+ * of ops in XML order with the sizes resolved, so applying a path looks at
+ * neither the types nor the values of its settings.
+ */
 struct mixer_path {
     char *name;
     unsigned int size;
     unsigned int length;
+    /* settings of the path being built */
+    struct mixer_setting *setting;
+    /* program of a sealed path */
+    const struct path_op *op;
+    const unsigned char *values;
+};
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    /* long double keeps data aligned for any setting value */
+    long double data[];
+};
+
+/* bump allocator, everything is released at once */
+struct arena {
+    struct arena_block *first;
+    struct arena_block *current;
+};
+
+/* a value set by a top level <ctl> tag, id -1 for all of them */
+struct init_value {
+    unsigned int ctl_index;
+    int id;
+};
+
+/*
+ * The path being parsed keeps its settings in a scratch array and its
+ * values in a scratch arena, both reused for every path. path_seal() then
+ * copies them into the route arena in one piece. Bumping the generation
+ * clears the control to setting map for the next path.
+ */
+struct path_builder {
+    /* database the paths are added to */
+    struct route_db *db;
+    struct mixer_path *path;
     struct mixer_setting *setting;
+    unsigned int size;
+    struct arena values;
+    /* per control setting index, valid where ctl_generation matches */
+    unsigned int generation;
+    unsigned int *ctl_generation;
+    unsigned int *ctl_setting;
+    /* values set by top level <ctl> tags */
+    struct init_value *init;
+    unsigned int num_init;
+    unsigned int init_size;
+};
+
+struct name_slot {
+    unsigned int hash;
+    unsigned int entry;     /* entry index + 1, 0 marks an empty slot */
+};
+
+/* open addressing hash from names to entry indices, the names are owned by
+   the indexed array and fetched through a callback when hashes collide */
+struct name_index {
+    unsigned int size;      /* number of slots, always a power of two */
+    unsigned int count;
+    struct name_slot *slot;
+};
+
+typedef const char *(*name_index_get_name)(void *data, unsigned int entry);
+
+/* names of an enum control, the strings are owned by the mixer */
+struct enum_table {
+    struct name_index index;
+    unsigned int num_enums;
+    const char *names[];
+};
+
+/*
+ * Parsed paths of one XML file for one control list. A database is
+ * immutable once published and shared by all audio routes initialized from
+ * the same XML for the same control list, in this process through the
+ * registry and across processes through the pages of a mapped path cache.
+ */
+struct route_db {
+    /* registry key and link, guarded by db_registry_lock */
+    uint64_t xml_hash;
+    uint64_t ctl_hash;
+    unsigned int num_ctls;
+    unsigned int refcount;
+    struct route_db *next;
+
+    unsigned int mixer_path_size;
+    unsigned int num_mixer_paths;
+    struct mixer_path *mixer_path;
+    struct name_index path_index;
+    /* top level <ctl> tags, applied to the mixer state of every audio route */
+    unsigned int num_init;
+    struct mixer_setting *init;
+    /* names, settings and values of all sealed paths */
+    struct arena path_arena;
+    /* path cache the setting values point into, or NULL */
+    const char *map;
+    size_t map_size;
+};
+
+/* per audio route state of the paths of one database */
+struct path_states {
+    struct route_db *db;
+    /* states of the database used before a reload, kept until free */
+    struct path_states *prev;
+    /* per path statistics, allocated when they are enabled */
+    struct audio_route_path_stats *stats;
+    /* times each path was applied and not reset since */
+    unsigned int active[];
 };
 
 struct audio_route {
+    const struct audio_route_mixer_ops *ops;
     struct mixer *mixer;
     unsigned int num_mixer_ctls;
     struct mixer_state *mixer_state;
+    struct name_index ctl_index;
+    /* one bit per control whose new_value may differ from old_value */
+    uint64_t *dirty_ctls;
 
-    unsigned int mixer_path_size;
-    unsigned int num_mixer_paths;
-    struct mixer_path *mixer_path;
+    /*
+     * Paths and the name indices are read-only after init and need no lock.
+     * The mixer state of a control is guarded by ctl_lock(); a thread holds
+     * at most one of those at a time, also while writing the control.
+     */
+    pthread_mutex_t ctl_locks[CTL_LOCK_STRIPES];
+
+    /* writes deferred by audio_route_begin() until audio_route_commit(),
+       only by the thread owning the transaction */
+    pthread_mutex_t transaction_lock;
+    pthread_t transaction_owner;
+    bool transaction_active;
+    unsigned int transaction_depth;
+    uint64_t *pending_map;
+    unsigned int *pending_ctls;
+    unsigned int num_pending;
+    unsigned int num_pending_requests;
+
+    /* controls stamped with mark_generation belong to the marked set */
+    pthread_mutex_t mark_lock;
+    unsigned int *ctl_mark;
+    unsigned int mark_generation;
+
+    /*
+     * Shared paths, swapped by audio_route_reload(), and the per path state.
+     * Replaced databases stay until free, so handles to their paths remain
+     * valid. reload_lock serializes reloads, which use the builder.
+     * Applied counts are changed with states_lock held for reading; a
+     * reload holds it for writing while it copies them and swaps.
+     */
+    struct route_db *db;
+    struct path_states *states;
+    pthread_mutex_t reload_lock;
+    pthread_rwlock_t states_lock;
+    struct path_builder builder;
+
+    /* runs requests from audio_route_submit(), when started */
+    struct route_worker *worker;
+
+    /* set by audio_route_enable_stats(), kept until audio_route_free() */
+    struct route_stats *stats;
+    /* set by audio_route_enable_ref_debug(), kept until audio_route_free() */
+    struct ref_debug *ref_debug;
+};
+
+/*
+ * Layout of the parsed path cache file, all in native byte order:
+ * header, path table, setting table (initial settings first, then the
+ * settings of each path), NUL terminated path names, value blobs.
+ * A state snapshot uses the same layout with only initial settings.
+ */
+struct route_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t long_size;
+    uint32_t num_ctls;
+    uint64_t source_hash;   /* XML contents for the path cache, boot id for snapshots */
+    uint64_t ctl_hash;
+    uint32_t num_paths;
+    uint32_t num_settings;
+    uint32_t num_init;
+    uint32_t reserved;
+    uint64_t strings_offset;
+    uint64_t values_offset;
+    uint64_t file_size;
+    uint64_t data_hash;     /* everything after the header */
+};
+
+struct route_cache_path {
+    uint32_t name_offset;
+    uint32_t first_setting;
+    uint32_t num_settings;
+    uint32_t reserved;
+};
+
+struct route_cache_setting {
+    uint32_t ctl_index;
+    uint32_t type;
+    uint32_t num_values;
+    /* first value set, only initial settings cover part of a control */
+    uint32_t index;
+    uint64_t value_offset;
 };
 
 struct config_parse_state {
     struct audio_route *ar;
     struct mixer_path *path;
     int level;
+    /* top level <ctl> tags are skipped when reloading */
+    bool reload;
+    /* values of the current <ctl>, typed like the control's, reused */
+    void *values;
+    size_t values_size;
 };
 
+/* name index functions */
+
+static unsigned int name_hash(const char *name)
+{
+    /* 32 bit FNV-1a */
+    unsigned int hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void name_index_free(struct name_index *idx)
+{
+    free(idx->slot);
+    idx->slot = NULL;
+    idx->size = 0;
+    idx->count = 0;
+}
+
+static int name_index_find(const struct name_index *idx, const char *name,
+                           name_index_get_name get_name, void *data)
+{
+    unsigned int hash;
+    unsigned int mask;
+    unsigned int i;
+
+    if (idx->size == 0)
+        return -1;
+
+    hash = name_hash(name);
+    mask = idx->size - 1;
+    for (i = hash & mask; idx->slot[i].entry; i = (i + 1) & mask) {
+        if (idx->slot[i].hash == hash &&
+            strcmp(get_name(data, idx->slot[i].entry - 1), name) == 0)
+            return idx->slot[i].entry - 1;
+    }
+
+    return -1;
+}
+
+static void name_index_insert(struct name_index *idx, unsigned int hash,
+                              unsigned int entry)
+{
+    unsigned int mask = idx->size - 1;
+    unsigned int i;
+
+    for (i = hash & mask; idx->slot[i].entry; i = (i + 1) & mask)
+        ;
+    idx->slot[i].hash = hash;
+    idx->slot[i].entry = entry + 1;
+    idx->count++;
+}
+
+/* callers check for duplicates with name_index_find() first */
+static int name_index_add(struct name_index *idx, const char *name,
+                          unsigned int entry)
+{
+    /* keep the load factor at or below one half */
+    if ((idx->count + 1) * 2 > idx->size) {
+        struct name_index grown;
+        unsigned int i;
+
+        grown.size = idx->size ? idx->size * 2 : INITIAL_NAME_INDEX_SIZE;
+        grown.count = 0;
+        grown.slot = calloc(grown.size, sizeof(struct name_slot));
+        if (!grown.slot) {
+            ALOGE("Unable to grow name index");
+            return -1;
+        }
+        for (i = 0; i < idx->size; i++)
+            if (idx->slot[i].entry)
+                name_index_insert(&grown, idx->slot[i].hash, idx->slot[i].entry - 1);
+
+        free(idx->slot);
+        *idx = grown;
+    }
+
+    name_index_insert(idx, name_hash(name), entry);
+    return 0;
+}
+
+/* arena functions */
+
+static void *arena_alloc(struct arena *arena, size_t size, size_t align)
+{
+    struct arena_block *block = arena->current;
+    size_t offset;
+
+    for (;;) {
+        if (block) {
+            offset = (block->used + align - 1) & ~(align - 1);
+            if (offset + size <= block->size) {
+                block->used = offset + size;
+                arena->current = block;
+                return (unsigned char *)block->data + offset;
+            }
+            /* blocks kept by arena_reset() are reused before growing */
+            if (block->next && block->next->size >= size) {
+                block = block->next;
+                block->used = 0;
+                continue;
+            }
+        }
+        break;
+    }
+
+    offset = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(*block) + offset);
+    if (!block) {
+        ALOGE("Unable to allocate %zu bytes of path storage", size);
+        return NULL;
+    }
+    block->size = offset;
+    block->used = size;
+    if (arena->current) {
+        block->next = arena->current->next;
+        arena->current->next = block;
+    } else {
+        block->next = NULL;
+        arena->first = block;
+    }
+    arena->current = block;
+
+    return block->data;
+}
+
+static char *arena_strdup(struct arena *arena, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(arena, len, 1);
+
+    if (copy)
+        memcpy(copy, str, len);
+    return copy;
+}
+
+/* forget everything allocated but keep the blocks for reuse */
+static void arena_reset(struct arena *arena)
+{
+    arena->current = arena->first;
+    if (arena->current)
+        arena->current->used = 0;
+}
+
+static void arena_free(struct arena *arena)
+{
+    struct arena_block *block = arena->first;
+
+    while (block) {
+        struct arena_block *next = block->next;
+
+        free(block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
 /* path functions */
 
 static bool is_supported_ctl_type(enum mixer_ctl_type type)
@@ -147,901 +565,3989 @@ static inline struct mixer_ctl *index_to_ctl(struct audio_route *ar,
     return ar->mixer_state[ctl_index].ctl;
 }
 
-#if 0
-static void path_print(struct audio_route *ar, struct mixer_path *path)
-{
-    unsigned int i;
-    unsigned int j;
+#define DIRTY_WORD_BITS 64
+#define DIRTY_WORDS(num_ctls) (((num_ctls) + DIRTY_WORD_BITS - 1) / DIRTY_WORD_BITS)
 
-    ALOGE("Path: %s, length: %d", path->name, path->length);
-    for (i = 0; i < path->length; i++) {
-        struct mixer_ctl *ctl = index_to_ctl(ar, path->setting[i].ctl_index);
-
-        ALOGE("  id=%d: ctl=%s", i, mixer_ctl_get_name(ctl));
-        if (mixer_ctl_get_type(ctl) == MIXER_CTL_TYPE_BYTE) {
-            for (j = 0; j < path->setting[i].num_values; j++)
-                ALOGE("    id=%d value=0x%02x", j, path->setting[i].value.bytes[j]);
-        } else if (mixer_ctl_get_type(ctl) == MIXER_CTL_TYPE_ENUM) {
-            for (j = 0; j < path->setting[i].num_values; j++)
-                ALOGE("    id=%d value=%d", j, path->setting[i].value.enumerated[j]);
-        } else {
-            for (j = 0; j < path->setting[i].num_values; j++)
-                ALOGE("    id=%d value=%ld", j, path->setting[i].value.integer[j]);
-        }
-    }
+static inline size_t ctl_values_size(const struct mixer_state *ms)
+{
+    return ms->num_values * ms->value_size;
 }
-#endif
 
-static void path_free(struct audio_route *ar)
+/* compare the raw value spans, whatever the control type */
+static inline bool ctl_values_changed(const struct mixer_state *ms)
 {
-    unsigned int i;
-
-    for (i = 0; i < ar->num_mixer_paths; i++) {
-        free(ar->mixer_path[i].name);
-        if (ar->mixer_path[i].setting) {
-            size_t j;
-            for (j = 0; j < ar->mixer_path[i].length; j++) {
-                free(ar->mixer_path[i].setting[j].value.ptr);
-            }
-            free(ar->mixer_path[i].setting);
-            ar->mixer_path[i].size = 0;
-            ar->mixer_path[i].length = 0;
-            ar->mixer_path[i].setting = NULL;
-        }
-    }
-    free(ar->mixer_path);
-    ar->mixer_path = NULL;
-    ar->mixer_path_size = 0;
-    ar->num_mixer_paths = 0;
+    return memcmp(ms->old_value.ptr, ms->new_value.ptr, ctl_values_size(ms)) != 0;
 }
 
-static struct mixer_path *path_get_by_name(struct audio_route *ar,
-                                           const char *name)
+/* record that new_value of a control was written, for audio_route_update_mixer */
+static inline void mark_ctl_dirty(struct audio_route *ar, unsigned int ctl_index)
 {
-    unsigned int i;
+    __atomic_fetch_or(&ar->dirty_ctls[ctl_index / DIRTY_WORD_BITS],
+                      (uint64_t)1 << (ctl_index % DIRTY_WORD_BITS), __ATOMIC_RELEASE);
+}
 
-    for (i = 0; i < ar->num_mixer_paths; i++)
-        if (strcmp(ar->mixer_path[i].name, name) == 0)
-            return &ar->mixer_path[i];
+static inline pthread_mutex_t *ctl_lock(struct audio_route *ar, unsigned int ctl_index)
+{
+    return &ar->ctl_locks[ctl_index % CTL_LOCK_STRIPES];
+}
 
-    return NULL;
+/* whether the calling thread has a transaction open */
+static inline bool in_transaction(struct audio_route *ar)
+{
+    return __atomic_load_n(&ar->transaction_active, __ATOMIC_ACQUIRE) &&
+           pthread_equal(__atomic_load_n(&ar->transaction_owner, __ATOMIC_RELAXED),
+                         pthread_self());
 }
 
-static struct mixer_path *path_create(struct audio_route *ar, const char *name)
+/* read the mixer value of a control the first time it is needed */
+static void load_ctl_value(struct audio_route *ar, unsigned int ctl_index)
 {
-    struct mixer_path *new_mixer_path = NULL;
+    struct mixer_state *ms = &ar->mixer_state[ctl_index];
+    int ret;
 
-    if (path_get_by_name(ar, name)) {
-        ALOGW("Path name '%s' already exists", name);
-        return NULL;
+    if (ms->type == MIXER_CTL_TYPE_ENUM) {
+        ret = ar->ops->ctl_get_value(ms->ctl, 0);
+        if (ret >= 0)
+            ms->old_value.enumerated[0] = ret;
+    } else {
+        ret = ar->ops->ctl_get_array(ms->ctl, ms->old_value.ptr, ms->num_values);
     }
 
-    /* check if we need to allocate more space for mixer paths */
-    if (ar->mixer_path_size <= ar->num_mixer_paths) {
-        if (ar->mixer_path_size == 0)
-            ar->mixer_path_size = INITIAL_MIXER_PATH_SIZE;
-        else
-            ar->mixer_path_size *= 2;
-
-        new_mixer_path = realloc(ar->mixer_path, ar->mixer_path_size *
-                                 sizeof(struct mixer_path));
-        if (new_mixer_path == NULL) {
-            ALOGE("Unable to allocate more paths");
-            return NULL;
-        } else {
-            ar->mixer_path = new_mixer_path;
-        }
+    /* start from zeros rather than read again: a path may have written the
+       control by then, and its value would become the reset value */
+    if (ret < 0) {
+        ALOGE("%s: unable to read mixer control '%s': %d", __func__,
+              ar->ops->ctl_get_name(ms->ctl), ret);
+        memset(ms->old_value.ptr, 0, ctl_values_size(ms));
     }
 
-    /* initialise the new mixer path */
-    ar->mixer_path[ar->num_mixer_paths].name = strdup(name);
-    ar->mixer_path[ar->num_mixer_paths].size = 0;
-    ar->mixer_path[ar->num_mixer_paths].length = 0;
-    ar->mixer_path[ar->num_mixer_paths].setting = NULL;
+    /* an untouched control resets to the value it had when first read */
+    memcpy(ms->new_value.ptr, ms->old_value.ptr, ctl_values_size(ms));
+    memcpy(ms->reset_value.ptr, ms->old_value.ptr, ctl_values_size(ms));
+    __atomic_store_n(&ms->loaded, true, __ATOMIC_RELEASE);
+}
 
-    /* return the mixer path just added, then increment number of them */
-    return &ar->mixer_path[ar->num_mixer_paths++];
+/* call before new_value or reset_value of a supported control is used */
+static inline void load_ctl(struct audio_route *ar, unsigned int ctl_index)
+{
+    if (!ar->mixer_state[ctl_index].loaded)
+        load_ctl_value(ar, ctl_index);
 }
 
-static int find_ctl_index_in_path(struct mixer_path *path,
-                                  unsigned int ctl_index)
+/* default backend, wrapped to match the ops whatever the tinyalsa constness */
+static struct mixer *tinyalsa_open(unsigned int card)
 {
-    unsigned int i;
+    return mixer_open(card);
+}
 
-    for (i = 0; i < path->length; i++)
-        if (path->setting[i].ctl_index == ctl_index)
-            return i;
+static void tinyalsa_close(struct mixer *mixer)
+{
+    mixer_close(mixer);
+}
 
-    return -1;
+static unsigned int tinyalsa_get_num_ctls(struct mixer *mixer)
+{
+    return mixer_get_num_ctls(mixer);
 }
 
-static int alloc_path_setting(struct mixer_path *path)
+static struct mixer_ctl *tinyalsa_get_ctl(struct mixer *mixer, unsigned int id)
 {
-    struct mixer_setting *new_path_setting;
-    int path_index;
+    return mixer_get_ctl(mixer, id);
+}
 
-    /* check if we need to allocate more space for path settings */
-    if (path->size <= path->length) {
-        if (path->size == 0)
-            path->size = INITIAL_MIXER_PATH_SIZE;
-        else
-            path->size *= 2;
+static const char *tinyalsa_ctl_get_name(struct mixer_ctl *ctl)
+{
+    return mixer_ctl_get_name(ctl);
+}
 
-        new_path_setting = realloc(path->setting,
-                                   path->size * sizeof(struct mixer_setting));
-        if (new_path_setting == NULL) {
-            ALOGE("Unable to allocate more path settings");
-            return -1;
-        } else {
-            path->setting = new_path_setting;
-        }
-    }
+static int tinyalsa_ctl_get_type(struct mixer_ctl *ctl)
+{
+    return mixer_ctl_get_type(ctl);
+}
 
-    path_index = path->length;
-    path->length++;
+static unsigned int tinyalsa_ctl_get_num_values(struct mixer_ctl *ctl)
+{
+    return mixer_ctl_get_num_values(ctl);
+}
 
-    return path_index;
+static unsigned int tinyalsa_ctl_get_num_enums(struct mixer_ctl *ctl)
+{
+    return mixer_ctl_get_num_enums(ctl);
 }
 
-static int path_add_setting(struct audio_route *ar, struct mixer_path *path,
-                            struct mixer_setting *setting)
+static const char *tinyalsa_ctl_get_enum_string(struct mixer_ctl *ctl, unsigned int enum_id)
 {
-    int path_index;
+    return mixer_ctl_get_enum_string(ctl, enum_id);
+}
 
-    if (find_ctl_index_in_path(path, setting->ctl_index) != -1) {
-        struct mixer_ctl *ctl = index_to_ctl(ar, setting->ctl_index);
+static int tinyalsa_ctl_get_value(struct mixer_ctl *ctl, unsigned int id)
+{
+    return mixer_ctl_get_value(ctl, id);
+}
 
-        ALOGW("Control '%s' already exists in path '%s' - Ignore one in the new sub path",
-              mixer_ctl_get_name(ctl), path->name);
-        return -2;
-    }
+static int tinyalsa_ctl_get_array(struct mixer_ctl *ctl, void *array, size_t count)
+{
+    return mixer_ctl_get_array(ctl, array, count);
+}
 
-    if (!is_supported_ctl_type(setting->type)) {
-        ALOGE("unsupported type %d", (int)setting->type);
-        return -1;
-    }
+static int tinyalsa_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value)
+{
+    return mixer_ctl_set_value(ctl, id, value);
+}
 
-    path_index = alloc_path_setting(path);
-    if (path_index < 0)
-        return -1;
+static int tinyalsa_ctl_set_array(struct mixer_ctl *ctl, const void *array, size_t count)
+{
+    return mixer_ctl_set_array(ctl, array, count);
+}
 
-    path->setting[path_index].ctl_index = setting->ctl_index;
-    path->setting[path_index].type = setting->type;
-    path->setting[path_index].num_values = setting->num_values;
+static const struct audio_route_mixer_ops tinyalsa_ops = {
+    .open = tinyalsa_open,
+    .close = tinyalsa_close,
+    .get_num_ctls = tinyalsa_get_num_ctls,
+    .get_ctl = tinyalsa_get_ctl,
+    .ctl_get_name = tinyalsa_ctl_get_name,
+    .ctl_get_type = tinyalsa_ctl_get_type,
+    .ctl_get_num_values = tinyalsa_ctl_get_num_values,
+    .ctl_get_num_enums = tinyalsa_ctl_get_num_enums,
+    .ctl_get_enum_string = tinyalsa_ctl_get_enum_string,
+    .ctl_get_value = tinyalsa_ctl_get_value,
+    .ctl_get_array = tinyalsa_ctl_get_array,
+    .ctl_set_value = tinyalsa_ctl_set_value,
+    .ctl_set_array = tinyalsa_ctl_set_array,
+};
 
-    size_t value_sz = sizeof_ctl_type(setting->type);
+/* path states */
 
-    path->setting[path_index].value.ptr = calloc(setting->num_values, value_sz);
-    /* copy all values */
-    memcpy(path->setting[path_index].value.ptr, setting->value.ptr,
-           setting->num_values * value_sz);
+static struct path_states *states_create(struct route_db *db)
+{
+    struct path_states *states = calloc(1, sizeof(struct path_states) +
+                                        db->num_mixer_paths * sizeof(unsigned int));
 
-    return 0;
+    if (states)
+        states->db = db;
+    return states;
 }
 
-static int path_add_value(struct audio_route *ar, struct mixer_path *path,
-                          struct mixer_value *mixer_value)
+/* index of path in the database of states, -1 for a path of another one */
+static inline int path_state_index(const struct path_states *states,
+                                   const struct mixer_path *path)
 {
-    unsigned int i;
-    int path_index;
-    unsigned int num_values;
-    struct mixer_ctl *ctl;
+    uintptr_t first = (uintptr_t)states->db->mixer_path;
+    uintptr_t p = (uintptr_t)path;
 
-    /* Check that mixer value index is within range */
-    ctl = index_to_ctl(ar, mixer_value->ctl_index);
-    num_values = mixer_ctl_get_num_values(ctl);
-    if (mixer_value->index >= (int)num_values) {
-        ALOGE("mixer index %d is out of range for '%s'", mixer_value->index,
-              mixer_ctl_get_name(ctl));
+    if (p < first || p >= first + states->db->num_mixer_paths * sizeof(*path))
         return -1;
-    }
-
-    path_index = find_ctl_index_in_path(path, mixer_value->ctl_index);
-    if (path_index < 0) {
-        /* New path */
+    return (p - first) / sizeof(*path);
+}
 
-        enum mixer_ctl_type type = mixer_ctl_get_type(ctl);
-        if (!is_supported_ctl_type(type)) {
-            ALOGE("unsupported type %d", (int)type);
-            return -1;
-        }
-        path_index = alloc_path_setting(path);
-        if (path_index < 0)
-            return -1;
+static struct mixer_path *db_get_path(struct route_db *db, const char *name);
 
-        /* initialise the new path setting */
-        path->setting[path_index].ctl_index = mixer_value->ctl_index;
-        path->setting[path_index].num_values = num_values;
-        path->setting[path_index].type = type;
+/* a path of a replaced database counts for the current path of that name */
+static int path_state_find(struct path_states *states, const struct mixer_path *path)
+{
+    int i = path_state_index(states, path);
 
-        size_t value_sz = sizeof_ctl_type(type);
-        path->setting[path_index].value.ptr = calloc(num_values, value_sz);
-        if (path->setting[path_index].type == MIXER_CTL_TYPE_BYTE)
-            path->setting[path_index].value.bytes[0] = mixer_value->value;
-        else if (path->setting[path_index].type == MIXER_CTL_TYPE_ENUM)
-            path->setting[path_index].value.enumerated[0] = mixer_value->value;
-        else
-            path->setting[path_index].value.integer[0] = mixer_value->value;
+    if (i < 0) {
+        path = db_get_path(states->db, path->name);
+        if (path)
+            i = path - states->db->mixer_path;
     }
+    return i;
+}
 
-    if (mixer_value->index == -1) {
+static void path_state_apply(struct audio_route *ar, const struct mixer_path *path)
+{
+    struct path_states *states;
+    int i;
+
+    pthread_rwlock_rdlock(&ar->states_lock);
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    i = path_state_find(states, path);
+    if (i >= 0)
+        __atomic_fetch_add(&states->active[i], 1, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&ar->states_lock);
+}
+
+static void path_state_reset(struct audio_route *ar, const struct mixer_path *path,
+                             bool force)
+{
+    struct path_states *states;
+    unsigned int count;
+    int i;
+
+    pthread_rwlock_rdlock(&ar->states_lock);
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    i = path_state_find(states, path);
+    if (i < 0)
+        goto done;
+
+    if (force) {
+        __atomic_store_n(&states->active[i], 0, __ATOMIC_RELAXED);
+        goto done;
+    }
+
+    count = __atomic_load_n(&states->active[i], __ATOMIC_RELAXED);
+    while (count > 0 &&
+           !__atomic_compare_exchange_n(&states->active[i], &count, count - 1, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+done:
+    pthread_rwlock_unlock(&ar->states_lock);
+}
+
+/* control references */
+
+/* a path holding count references on a control, NULL if taken before debugging */
+struct ctl_holder {
+    const struct mixer_path *path;
+    unsigned int count;
+};
+
+struct ctl_holders {
+    unsigned int num;
+    unsigned int size;
+    struct ctl_holder *holder;
+};
+
+struct ref_debug {
+    bool enabled;
+    unsigned long errors;
+    /* per control, under its ctl lock */
+    struct ctl_holders *ctls;
+};
+
+static const char *holder_name(const struct mixer_path *path)
+{
+    return path ? path->name : "(unknown)";
+}
+
+static struct ctl_holder *holder_find(struct ctl_holders *holders,
+                                      const struct mixer_path *path)
+{
+    unsigned int i;
+
+    for (i = 0; i < holders->num; i++)
+        if (holders->holder[i].path == path)
+            return &holders->holder[i];
+    return NULL;
+}
+
+static void holder_add(struct ctl_holders *holders, const struct mixer_path *path,
+                       unsigned int count)
+{
+    struct ctl_holder *holder = holder_find(holders, path);
+
+    if (holder) {
+        holder->count += count;
+        return;
+    }
+
+    if (holders->num == holders->size) {
+        unsigned int size = holders->size ? holders->size * 2 : 4;
+
+        holder = realloc(holders->holder, size * sizeof(struct ctl_holder));
+        if (!holder) {
+            ALOGE("%s: unable to allocate", __func__);
+            return;
+        }
+        holders->holder = holder;
+        holders->size = size;
+    }
+    holders->holder[holders->num].path = path;
+    holders->holder[holders->num].count = count;
+    holders->num++;
+}
+
+static void holder_remove(struct ctl_holders *holders, struct ctl_holder *holder)
+{
+    *holder = holders->holder[--holders->num];
+}
+
+static struct ref_debug *ref_debug_get(struct audio_route *ar)
+{
+    struct ref_debug *rd = __atomic_load_n(&ar->ref_debug, __ATOMIC_ACQUIRE);
+
+    if (!rd || !__atomic_load_n(&rd->enabled, __ATOMIC_RELAXED))
+        return NULL;
+    return rd;
+}
+
+/* take a reference of path on a control, called with the ctl lock held */
+static void ctl_ref_get(struct audio_route *ar, unsigned int ctl_index,
+                        const struct mixer_path *path)
+{
+    struct ref_debug *rd = ref_debug_get(ar);
+
+    ar->mixer_state[ctl_index].active_count++;
+    if (rd)
+        holder_add(&rd->ctls[ctl_index], path, 1);
+}
+
+/*
+ * Drop a reference of path on a control, or all of them when forced, called
+ * with the ctl lock held. With debugging, dropping references of other paths
+ * is reported; a path reset without having been applied drops nothing.
+ */
+static void ctl_ref_put(struct audio_route *ar, unsigned int ctl_index,
+                        const struct mixer_path *path, bool force)
+{
+    struct mixer_state *ms = &ar->mixer_state[ctl_index];
+    struct ref_debug *rd = ref_debug_get(ar);
+    struct ctl_holders *holders;
+    struct ctl_holder *holder;
+    unsigned int i;
+
+    if (ms->active_count == 0)
+        return;
+    ms->active_count = force ? 0 : ms->active_count - 1;
+    if (!rd)
+        return;
+
+    holders = &rd->ctls[ctl_index];
+    if (force) {
+        for (i = 0; i < holders->num; i++) {
+            if (holders->holder[i].path == path || !holders->holder[i].path)
+                continue;
+            ALOGE("forced reset of path '%s' drops %u references of path '%s' on '%s'",
+                  path->name, holders->holder[i].count, holders->holder[i].path->name,
+                  ar->ops->ctl_get_name(ms->ctl));
+            __atomic_fetch_add(&rd->errors, 1, __ATOMIC_RELAXED);
+        }
+        holders->num = 0;
+        return;
+    }
+
+    holder = holder_find(holders, path);
+    if (!holder) {
+        /* references from before debugging was enabled may be anyone's */
+        holder = holder_find(holders, NULL);
+        if (!holder && holders->num) {
+            holder = &holders->holder[0];
+            ALOGE("path '%s' drops a reference on '%s' held by path '%s'",
+                  path->name, ar->ops->ctl_get_name(ms->ctl), holder->path->name);
+            __atomic_fetch_add(&rd->errors, 1, __ATOMIC_RELAXED);
+        }
+        if (!holder)
+            return;
+    }
+    if (--holder->count == 0)
+        holder_remove(holders, holder);
+}
+
+/* routing statistics */
+
+enum stats_op {
+    STATS_LOOKUP,
+    STATS_APPLY,
+    STATS_RESET,
+    STATS_UPDATE,
+    STATS_NUM_OPS
+};
+
+static const char *const stats_op_names[STATS_NUM_OPS] = {
+    "lookup", "apply", "reset", "update"
+};
+
+struct ctl_stats {
+    unsigned long writes;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+/* updated with relaxed atomics from any thread, read without a lock */
+struct route_stats {
+    unsigned int flags;
+    int trace_fd;
+    struct audio_route_latency op[STATS_NUM_OPS];
+    struct audio_route_latency ctl_write;
+    /* the per path statistics are kept with the path states */
+    struct ctl_stats *ctls;
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* the statistics if any of flags is enabled, the only cost while disabled */
+static inline struct route_stats *stats_get(struct audio_route *ar, unsigned int flags)
+{
+    struct route_stats *stats = __atomic_load_n(&ar->stats, __ATOMIC_ACQUIRE);
+
+    if (__builtin_expect(!stats, 1))
+        return NULL;
+    return __atomic_load_n(&stats->flags, __ATOMIC_RELAXED) & flags ? stats : NULL;
+}
+
+static void stats_max(uint64_t *max, uint64_t value)
+{
+    uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+    while (value > cur &&
+           !__atomic_compare_exchange_n(max, &cur, value, true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+}
+
+static void latency_add(struct audio_route_latency *lat, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+    if (bucket >= AUDIO_ROUTE_STATS_BUCKETS)
+        bucket = AUDIO_ROUTE_STATS_BUCKETS - 1;
+    __atomic_fetch_add(&lat->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lat->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lat->hist[bucket], 1, __ATOMIC_RELAXED);
+    stats_max(&lat->max_ns, ns);
+}
+
+/* systrace format, so the events show up as slices of the calling thread */
+static void trace_begin(struct route_stats *stats, const char *what, const char *name)
+{
+    char buf[TRACE_BUF_SIZE];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "B|%d|audio_route %s %s", (int)getpid(), what,
+                   name ? name : "");
+    if (len >= (int)sizeof(buf))
+        len = sizeof(buf) - 1;
+    if (write(stats->trace_fd, buf, len) < 0)
+        return;
+}
+
+static void trace_end(struct route_stats *stats)
+{
+    char buf[32];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "E|%d", (int)getpid());
+    if (write(stats->trace_fd, buf, len) < 0)
+        return;
+}
+
+static uint64_t stats_begin(struct route_stats *stats, enum stats_op op, const char *name)
+{
+    if ((__atomic_load_n(&stats->flags, __ATOMIC_RELAXED) & AUDIO_ROUTE_STATS_TRACE) &&
+        op != STATS_LOOKUP)
+        trace_begin(stats, stats_op_names[op], name);
+    return now_ns();
+}
+
+/* per path part of stats_end() */
+static void stats_path_add(struct audio_route *ar, enum stats_op op,
+                           const struct mixer_path *path, uint64_t ns)
+{
+    struct audio_route_path_stats *ps = NULL;
+    struct path_states *states;
+    int i;
+
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    ps = __atomic_load_n(&states->stats, __ATOMIC_ACQUIRE);
+    i = path_state_index(states, path);
+    if (!ps || i < 0)
+        return;
+    ps += i;
+
+    switch (op) {
+    case STATS_APPLY:
+        __atomic_fetch_add(&ps->applies, 1, __ATOMIC_RELAXED);
+        break;
+    case STATS_RESET:
+        __atomic_fetch_add(&ps->resets, 1, __ATOMIC_RELAXED);
+        break;
+    case STATS_UPDATE:
+        __atomic_fetch_add(&ps->updates, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ps->update_ns, ns, __ATOMIC_RELAXED);
+        stats_max(&ps->max_update_ns, ns);
+        break;
+    default:
+        break;
+    }
+}
+
+/* account a call started by stats_begin(), path is NULL for mixer updates */
+static void stats_end(struct audio_route *ar, struct route_stats *stats, enum stats_op op,
+                      const struct mixer_path *path, uint64_t start)
+{
+    unsigned int flags = __atomic_load_n(&stats->flags, __ATOMIC_RELAXED);
+    uint64_t ns = now_ns() - start;
+
+    if ((flags & AUDIO_ROUTE_STATS_TRACE) && op != STATS_LOOKUP)
+        trace_end(stats);
+    if (!(flags & AUDIO_ROUTE_STATS_COUNT))
+        return;
+
+    latency_add(&stats->op[op], ns);
+    if (path)
+        stats_path_add(ar, op, path, ns);
+}
+
+/* account one call made for a set of paths to each of them */
+static void stats_end_paths(struct audio_route *ar, struct route_stats *stats, enum stats_op op,
+                            struct mixer_path *const paths[], unsigned int num_paths,
+                            uint64_t start)
+{
+    unsigned int flags = __atomic_load_n(&stats->flags, __ATOMIC_RELAXED);
+    uint64_t ns = now_ns() - start;
+    unsigned int p;
+
+    if ((flags & AUDIO_ROUTE_STATS_TRACE) && op != STATS_LOOKUP)
+        trace_end(stats);
+    if (!(flags & AUDIO_ROUTE_STATS_COUNT))
+        return;
+
+    latency_add(&stats->op[op], ns);
+    for (p = 0; p < num_paths; p++)
+        stats_path_add(ar, op, paths[p], ns);
+}
+
+static bool use_delta_write(const struct mixer_state *ms)
+{
+    if (ms->write_kind != CTL_WRITE_RANGE)
+        return false;
+
+    switch (ms->write_mode) {
+    case AUDIO_ROUTE_WRITE_FULL:
+        return false;
+    case AUDIO_ROUTE_WRITE_DELTA:
+        return true;
+    default:
+        return ctl_values_size(ms) >= DELTA_WRITE_MIN_SIZE;
+    }
+}
+
+/*
+ * Write value to a control. current is what the mixer holds, if known:
+ * large arrays then only get the span from the first to the last changed
+ * value written, falling back to a full write if the backend refuses.
+ */
+static int ctl_write_value(struct audio_route *ar, struct mixer_state *ms,
+                           union ctl_values value, const void *current)
+{
+    if (ms->write_kind == CTL_WRITE_VALUE)
+        return ar->ops->ctl_set_value(ms->ctl, 0, value.enumerated[0]);
+
+    if (current && use_delta_write(ms)) {
+        const unsigned char *from = current;
+        const unsigned char *to = value.bytes;
+        size_t size = ctl_values_size(ms);
+        size_t first = 0, last = size;
+
+        while (first < size && from[first] == to[first])
+            first++;
+        while (last > first && from[last - 1] == to[last - 1])
+            last--;
+        if (first == last)
+            return 0;
+
+        first /= ms->value_size;
+        last = (last + ms->value_size - 1) / ms->value_size;
+        if (ar->ops->ctl_set_array_range(ms->ctl, to + first * ms->value_size,
+                                         first, last - first) == 0)
+            return 0;
+    }
+
+    return ar->ops->ctl_set_array(ms->ctl, value.ptr, ms->num_values);
+}
+
+/* ctl_write_value(), timed and traced when enabled */
+static int mixer_ctl_write(struct audio_route *ar, struct mixer_state *ms,
+                           union ctl_values value, const void *current)
+{
+    struct route_stats *stats = stats_get(ar, AUDIO_ROUTE_STATS_COUNT | AUDIO_ROUTE_STATS_TRACE);
+    struct ctl_stats *cs;
+    uint64_t start, ns;
+    unsigned int flags;
+    int ret;
+
+    if (!stats)
+        return ctl_write_value(ar, ms, value, current);
+
+    flags = __atomic_load_n(&stats->flags, __ATOMIC_RELAXED);
+    if (flags & AUDIO_ROUTE_STATS_TRACE)
+        trace_begin(stats, "write", ar->ops->ctl_get_name(ms->ctl));
+    start = now_ns();
+    ret = ctl_write_value(ar, ms, value, current);
+    ns = now_ns() - start;
+    if (flags & AUDIO_ROUTE_STATS_TRACE)
+        trace_end(stats);
+
+    if (flags & AUDIO_ROUTE_STATS_COUNT) {
+        /* the writer holds ctl_lock(), the atomics are for the readers */
+        cs = &stats->ctls[ms - ar->mixer_state];
+        latency_add(&stats->ctl_write, ns);
+        __atomic_fetch_add(&cs->writes, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cs->total_ns, ns, __ATOMIC_RELAXED);
+        stats_max(&cs->max_ns, ns);
+    }
+
+    return ret;
+}
+
+/*
+ * Write new_value of a control to the mixer, with its ctl_lock() held.
+ * Inside a transaction the write is only queued; callers copy new_value to
+ * old_value as usual, and the commit writes old_value, which then holds the
+ * last value requested. The pending bit of a control only changes under its
+ * ctl lock, other bits of the word under theirs.
+ */
+static void write_ctl(struct audio_route *ar, unsigned int ctl_index)
+{
+    struct mixer_state *ms = &ar->mixer_state[ctl_index];
+    uint64_t *word = &ar->pending_map[ctl_index / DIRTY_WORD_BITS];
+    uint64_t bit = (uint64_t)1 << (ctl_index % DIRTY_WORD_BITS);
+    size_t value_sz = ctl_values_size(ms);
+
+    if (!in_transaction(ar)) {
+        if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & bit)) {
+            mixer_ctl_write(ar, ms, ms->new_value, ms->old_value.ptr);
+            return;
+        }
+
+        /* queued by another thread's transaction: old_value is the queued
+           value, the mixer has committed_value, which the commit compares
+           with and writes the difference from */
+        mixer_ctl_write(ar, ms, ms->new_value, ms->committed_value.ptr);
+        if (ms->committed_value.ptr)
+            memcpy(ms->committed_value.ptr, ms->new_value.ptr, value_sz);
+        return;
+    }
+
+    ar->num_pending_requests++;
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit)
+        return;
+
+    /* old_value still holds what the mixer has, keep it so that the commit
+       can drop writes that end up restoring it */
+    if (!ms->committed_value.ptr)
+        ms->committed_value.ptr = malloc(value_sz);
+    if (ms->committed_value.ptr)
+        memcpy(ms->committed_value.ptr, ms->old_value.ptr, value_sz);
+
+    __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+    ar->pending_ctls[ar->num_pending++] = ctl_index;
+}
+
+/* the setting a sealed path's op was compiled from */
+static void path_op_setting(struct audio_route *ar, const struct mixer_path *path,
+                            unsigned int i, struct mixer_setting *setting)
+{
+    const struct mixer_state *ms = &ar->mixer_state[path->op[i].ctl_index];
+
+    setting->ctl_index = path->op[i].ctl_index;
+    setting->index = 0;
+    setting->num_values = ms->num_values;
+    setting->type = ms->type;
+    setting->value.ptr = (void *)(path->values + path->op[i].offset);
+}
+
+static void builder_free(struct path_builder *builder)
+{
+    free(builder->setting);
+    builder->setting = NULL;
+    builder->size = 0;
+    builder->path = NULL;
+    arena_free(&builder->values);
+    free(builder->ctl_generation);
+    builder->ctl_generation = NULL;
+    free(builder->ctl_setting);
+    builder->ctl_setting = NULL;
+    builder->generation = 0;
+    free(builder->init);
+    builder->init = NULL;
+    builder->num_init = 0;
+    builder->init_size = 0;
+    builder->db = NULL;
+}
+
+/* remember which values the initial settings set, saved by db_save_init() */
+static void builder_add_init(struct audio_route *ar, unsigned int ctl_index, int id)
+{
+    struct path_builder *builder = &ar->builder;
+    struct init_value *init;
+    unsigned int size;
+
+    if (builder->num_init == builder->init_size) {
+        size = builder->init_size ? builder->init_size * 2 : INITIAL_MIXER_PATH_SIZE;
+        init = realloc(builder->init, size * sizeof(*init));
+        if (!init) {
+            ALOGE("Unable to allocate more initial settings");
+            return;
+        }
+        builder->init = init;
+        builder->init_size = size;
+    }
+    builder->init[builder->num_init].ctl_index = ctl_index;
+    builder->init[builder->num_init].id = id;
+    builder->num_init++;
+}
+
+/* drop all paths and initial settings */
+static void db_reset(struct route_db *db)
+{
+    free(db->mixer_path);
+    db->mixer_path = NULL;
+    db->mixer_path_size = 0;
+    db->num_mixer_paths = 0;
+    db->init = NULL;
+    db->num_init = 0;
+    name_index_free(&db->path_index);
+    arena_free(&db->path_arena);
+    if (db->map)
+        munmap((void *)db->map, db->map_size);
+    db->map = NULL;
+    db->map_size = 0;
+}
+
+static void db_free(struct route_db *db)
+{
+    db_reset(db);
+    free(db);
+}
+
+static const char *path_index_get_name(void *data, unsigned int entry)
+{
+    struct route_db *db = data;
+
+    return db->mixer_path[entry].name;
+}
+
+static struct mixer_path *db_get_path(struct route_db *db, const char *name)
+{
+    int i = name_index_find(&db->path_index, name, path_index_get_name, db);
+
+    return i < 0 ? NULL : &db->mixer_path[i];
+}
+
+static struct mixer_path *path_get_by_name(struct audio_route *ar,
+                                           const char *name)
+{
+    return db_get_path(__atomic_load_n(&ar->db, __ATOMIC_ACQUIRE), name);
+}
+
+static const char *ctl_index_get_name(void *data, unsigned int entry)
+{
+    struct audio_route *ar = data;
+
+    return ar->ops->ctl_get_name(ar->mixer_state[entry].ctl);
+}
+
+static int ctl_get_index_by_name(struct audio_route *ar, const char *name)
+{
+    return name_index_find(&ar->ctl_index, name, ctl_index_get_name, ar);
+}
+
+/*
+ * Compile the path being built into ops in the route arena, with its values
+ * in one block grouped by size so none needs padding. The ops keep the XML
+ * order: audio_route_update_path() writes them in that order, or in reverse
+ * when resetting, and codecs can depend on it.
+ */
+static int path_seal(struct audio_route *ar)
+{
+    static const size_t value_sizes[] = { sizeof(long), sizeof(int), sizeof(unsigned char) };
+    struct path_builder *builder = &ar->builder;
+    struct mixer_path *path = builder->path;
+    struct path_op *op = NULL;
+    unsigned char *values = NULL;
+    size_t values_size = 0, offset = 0;
+    unsigned int i, j;
+    int ret = 0;
+
+    if (!path)
+        return 0;
+
+    for (i = 0; i < path->length; i++)
+        values_size += path->setting[i].num_values * sizeof_ctl_type(path->setting[i].type);
+
+    if (path->length) {
+        op = arena_alloc(&builder->db->path_arena, path->length * sizeof(*op),
+                         sizeof(void *));
+        if (values_size)
+            values = arena_alloc(&builder->db->path_arena, values_size, sizeof(long));
+        if (!op || (values_size && !values))
+            goto err;
+    }
+
+    for (j = 0; j < sizeof(value_sizes) / sizeof(value_sizes[0]); j++) {
+        /* long and int have the same size on 32 bit, place those values once */
+        if (j && value_sizes[j] == value_sizes[j - 1])
+            continue;
+        for (i = 0; i < path->length; i++) {
+            const struct mixer_setting *setting = &path->setting[i];
+            size_t value_sz = sizeof_ctl_type(setting->type);
+
+            if (value_sz != value_sizes[j])
+                continue;
+            op[i].ctl_index = setting->ctl_index;
+            op[i].size = setting->num_values * value_sz;
+            op[i].offset = offset;
+            memcpy(values + offset, setting->value.ptr, op[i].size);
+            offset += op[i].size;
+        }
+    }
+    if (offset != values_size)
+        goto err;
+    goto done;
+
+err:
+    ALOGE("Unable to store path '%s'", path->name);
+    op = NULL;
+    values = NULL;
+    path->length = 0;
+    ret = -1;
+done:
+    path->op = op;
+    path->values = values;
+    path->setting = NULL;
+    path->size = 0;
+    builder->path = NULL;
+    arena_reset(&builder->values);
+    return ret;
+}
+
+/* add an empty path to the database */
+static struct mixer_path *path_alloc(struct route_db *db, const char *name)
+{
+    struct mixer_path *new_mixer_path = NULL;
+    struct mixer_path *path;
+
+    /* check if we need to allocate more space for mixer paths */
+    if (db->mixer_path_size <= db->num_mixer_paths) {
+        if (db->mixer_path_size == 0)
+            db->mixer_path_size = INITIAL_MIXER_PATH_SIZE;
+        else
+            db->mixer_path_size *= 2;
+
+        new_mixer_path = realloc(db->mixer_path, db->mixer_path_size *
+                                 sizeof(struct mixer_path));
+        if (new_mixer_path == NULL) {
+            ALOGE("Unable to allocate more paths");
+            return NULL;
+        } else {
+            db->mixer_path = new_mixer_path;
+        }
+    }
+
+    /* initialise the new mixer path */
+    path = &db->mixer_path[db->num_mixer_paths];
+    path->name = arena_strdup(&db->path_arena, name);
+    path->size = 0;
+    path->length = 0;
+    path->setting = NULL;
+    path->op = NULL;
+    path->values = NULL;
+    if (!path->name)
+        return NULL;
+
+    if (name_index_add(&db->path_index, name, db->num_mixer_paths) < 0)
+        return NULL;
+
+    db->num_mixer_paths++;
+    return path;
+}
+
+static struct mixer_path *path_create(struct audio_route *ar, const char *name)
+{
+    struct path_builder *builder = &ar->builder;
+    struct mixer_path *path;
+
+    if (db_get_path(builder->db, name)) {
+        ALOGW("Path name '%s' already exists", name);
+        return NULL;
+    }
+
+    /* a path is only built while no other path is */
+    path_seal(ar);
+
+    path = path_alloc(builder->db, name);
+    if (!path)
+        return NULL;
+
+    /* without the map duplicates are found by scanning the path */
+    if (!builder->ctl_generation && ar->num_mixer_ctls) {
+        builder->ctl_generation = calloc(ar->num_mixer_ctls, sizeof(unsigned int));
+        builder->ctl_setting = malloc(ar->num_mixer_ctls * sizeof(unsigned int));
+        if (!builder->ctl_generation || !builder->ctl_setting) {
+            free(builder->ctl_generation);
+            free(builder->ctl_setting);
+            builder->ctl_generation = NULL;
+            builder->ctl_setting = NULL;
+        }
+    }
+    if (++builder->generation == 0 && builder->ctl_generation) {
+        /* wrapped, stale entries could match again */
+        memset(builder->ctl_generation, 0, ar->num_mixer_ctls * sizeof(unsigned int));
+        builder->generation = 1;
+    }
+
+    builder->path = path;
+    return path;
+}
+
+static int find_ctl_index_in_path(struct audio_route *ar, struct mixer_path *path,
+                                  unsigned int ctl_index)
+{
+    struct path_builder *builder = &ar->builder;
+    unsigned int i;
+
+    /* sealed paths are not changed, see alloc_path_setting() */
+    if (path != builder->path)
+        return -1;
+
+    if (builder->ctl_generation) {
+        if (builder->ctl_generation[ctl_index] != builder->generation)
+            return -1;
+        return builder->ctl_setting[ctl_index];
+    }
+
+    for (i = 0; i < path->length; i++)
+        if (path->setting[i].ctl_index == ctl_index)
+            return i;
+
+    return -1;
+}
+
+static int alloc_path_setting(struct audio_route *ar, struct mixer_path *path,
+                              unsigned int ctl_index)
+{
+    struct path_builder *builder = &ar->builder;
+    struct mixer_setting *new_path_setting;
+    unsigned int size;
+
+    if (path != builder->path) {
+        ALOGE("Path '%s' can no longer be changed", path->name);
+        return -1;
+    }
+
+    /* check if we need to allocate more space for path settings */
+    if (builder->size <= path->length) {
+        size = builder->size ? builder->size * 2 : INITIAL_MIXER_PATH_SIZE;
+
+        new_path_setting = realloc(builder->setting, size * sizeof(struct mixer_setting));
+        if (new_path_setting == NULL) {
+            ALOGE("Unable to allocate more path settings");
+            return -1;
+        } else {
+            builder->setting = new_path_setting;
+            builder->size = size;
+        }
+    }
+    path->setting = builder->setting;
+    path->size = builder->size;
+    path->setting[path->length].index = 0;
+
+    if (builder->ctl_generation) {
+        builder->ctl_generation[ctl_index] = builder->generation;
+        builder->ctl_setting[ctl_index] = path->length;
+    }
+
+    return path->length++;
+}
+
+static int path_add_setting(struct audio_route *ar, struct mixer_path *path,
+                            struct mixer_setting *setting)
+{
+    int path_index;
+
+    if (find_ctl_index_in_path(ar, path, setting->ctl_index) != -1) {
+        struct mixer_ctl *ctl = index_to_ctl(ar, setting->ctl_index);
+
+        ALOGW("Control '%s' already exists in path '%s' - Ignore one in the new sub path",
+              ar->ops->ctl_get_name(ctl), path->name);
+        return -2;
+    }
+
+    if (!is_supported_ctl_type(setting->type)) {
+        ALOGE("unsupported type %d", (int)setting->type);
+        return -1;
+    }
+
+    size_t value_sz = sizeof_ctl_type(setting->type);
+    void *value = arena_alloc(&ar->builder.values, setting->num_values * value_sz, value_sz);
+
+    if (!value)
+        return -1;
+
+    path_index = alloc_path_setting(ar, path, setting->ctl_index);
+    if (path_index < 0)
+        return -1;
+
+    path->setting[path_index].ctl_index = setting->ctl_index;
+    path->setting[path_index].type = setting->type;
+    path->setting[path_index].num_values = setting->num_values;
+    path->setting[path_index].value.ptr = value;
+
+    /* copy all values */
+    memcpy(path->setting[path_index].value.ptr, setting->value.ptr,
+           setting->num_values * value_sz);
+
+    return 0;
+}
+
+static int path_add_value(struct audio_route *ar, struct mixer_path *path,
+                          struct mixer_value *mixer_value)
+{
+    unsigned int i;
+    int path_index;
+    unsigned int num_values;
+    struct mixer_ctl *ctl;
+
+    /* Check that mixer value index is within range */
+    ctl = index_to_ctl(ar, mixer_value->ctl_index);
+    num_values = ar->ops->ctl_get_num_values(ctl);
+    if (mixer_value->index >= (int)num_values) {
+        ALOGE("mixer index %d is out of range for '%s'", mixer_value->index,
+              ar->ops->ctl_get_name(ctl));
+        return -1;
+    }
+
+    path_index = find_ctl_index_in_path(ar, path, mixer_value->ctl_index);
+    if (path_index < 0) {
+        /* New path */
+
+        enum mixer_ctl_type type = ar->mixer_state[mixer_value->ctl_index].type;
+        if (!is_supported_ctl_type(type)) {
+            ALOGE("unsupported type %d", (int)type);
+            return -1;
+        }
+        size_t value_sz = sizeof_ctl_type(type);
+        void *value = arena_alloc(&ar->builder.values, num_values * value_sz, value_sz);
+
+        if (!value)
+            return -1;
+        memset(value, 0, num_values * value_sz);
+
+        path_index = alloc_path_setting(ar, path, mixer_value->ctl_index);
+        if (path_index < 0)
+            return -1;
+
+        /* initialise the new path setting */
+        path->setting[path_index].ctl_index = mixer_value->ctl_index;
+        path->setting[path_index].num_values = num_values;
+        path->setting[path_index].type = type;
+        path->setting[path_index].value.ptr = value;
+        if (path->setting[path_index].type == MIXER_CTL_TYPE_BYTE)
+            path->setting[path_index].value.bytes[0] = mixer_value->value;
+        else if (path->setting[path_index].type == MIXER_CTL_TYPE_ENUM)
+            path->setting[path_index].value.enumerated[0] = mixer_value->value;
+        else
+            path->setting[path_index].value.integer[0] = mixer_value->value;
+    }
+
+    if (mixer_value->index == -1) {
         /* set all values the same except for CTL_TYPE_BYTE and CTL_TYPE_INT */
-        if (path->setting[path_index].type == MIXER_CTL_TYPE_BYTE) {
-            for (i = 0; i < num_values; i++)
-                path->setting[path_index].value.bytes[i] = mixer_value->values[i];
-        } else if (path->setting[path_index].type == MIXER_CTL_TYPE_INT) {
-            for (i = 0; i < num_values; i++)
-                path->setting[path_index].value.integer[i] = mixer_value->values[i];
+        if (path->setting[path_index].type == MIXER_CTL_TYPE_BYTE ||
+            path->setting[path_index].type == MIXER_CTL_TYPE_INT) {
+            memcpy(path->setting[path_index].value.ptr, mixer_value->values.ptr,
+                   num_values * sizeof_ctl_type(path->setting[path_index].type));
         } else if (path->setting[path_index].type == MIXER_CTL_TYPE_ENUM) {
             for (i = 0; i < num_values; i++)
                 path->setting[path_index].value.enumerated[i] = mixer_value->value;
         } else {
-            for (i = 0; i < num_values; i++)
-                path->setting[path_index].value.integer[i] = mixer_value->value;
+            for (i = 0; i < num_values; i++)
+                path->setting[path_index].value.integer[i] = mixer_value->value;
+        }
+    } else {
+        /* set only one value */
+        if (path->setting[path_index].type == MIXER_CTL_TYPE_BYTE)
+            path->setting[path_index].value.bytes[mixer_value->index] = mixer_value->value;
+        else if (path->setting[path_index].type == MIXER_CTL_TYPE_ENUM)
+            path->setting[path_index].value.enumerated[mixer_value->index] = mixer_value->value;
+        else
+            path->setting[path_index].value.integer[mixer_value->index] = mixer_value->value;
+    }
+
+    return 0;
+}
+
+static int path_add_path(struct audio_route *ar, struct mixer_path *path,
+                         struct mixer_path *sub_path)
+{
+    struct mixer_setting setting;
+    unsigned int i;
+
+    /* a path including itself adds nothing */
+    if (sub_path == ar->builder.path)
+        return 0;
+
+    for (i = 0; i < sub_path->length; i++) {
+        path_op_setting(ar, sub_path, i, &setting);
+        int retVal = path_add_setting(ar, path, &setting);
+        if (retVal < 0) {
+            if (retVal == -2)
+                continue;
+            else
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static int path_apply(struct audio_route *ar, struct mixer_path *path)
+{
+    unsigned int i;
+    unsigned int ctl_index;
+
+    ALOGD("Apply path: %s", path->name != NULL ? path->name : "none");
+    /* ops only write supported types, checked when the settings were added */
+    for (i = 0; i < path->length; i++) {
+        ctl_index = path->op[i].ctl_index;
+        pthread_mutex_lock(ctl_lock(ar, ctl_index));
+        load_ctl(ar, ctl_index);
+        memcpy(ar->mixer_state[ctl_index].new_value.ptr, path->values + path->op[i].offset,
+               path->op[i].size);
+        mark_ctl_dirty(ar, ctl_index);
+        pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+    }
+
+    return 0;
+}
+
+static int path_reset(struct audio_route *ar, struct mixer_path *path)
+{
+    unsigned int i;
+    unsigned int ctl_index;
+
+    ALOGV("Reset path: %s", path->name != NULL ? path->name : "none");
+    for (i = 0; i < path->length; i++) {
+        ctl_index = path->op[i].ctl_index;
+        pthread_mutex_lock(ctl_lock(ar, ctl_index));
+        load_ctl(ar, ctl_index);
+        /* reset the value(s) */
+        memcpy(ar->mixer_state[ctl_index].new_value.ptr,
+               ar->mixer_state[ctl_index].reset_value.ptr, path->op[i].size);
+        mark_ctl_dirty(ar, ctl_index);
+        pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+    }
+
+    return 0;
+}
+
+/* mixer helper function */
+static const char *enum_table_get_name(void *data, unsigned int entry)
+{
+    struct enum_table *table = data;
+
+    return table->names[entry];
+}
+
+/* fetch the enum names of a control once and index them */
+static struct enum_table *enum_table_get(struct audio_route *ar, unsigned int ctl_index)
+{
+    struct mixer_state *ms = &ar->mixer_state[ctl_index];
+    struct enum_table *table;
+    unsigned int num_enums;
+    unsigned int i;
+
+    table = __atomic_load_n(&ms->enums, __ATOMIC_ACQUIRE);
+    if (table)
+        return table;
+
+    pthread_mutex_lock(ctl_lock(ar, ctl_index));
+    if (ms->enums) {
+        pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+        return ms->enums;
+    }
+
+    num_enums = ar->ops->ctl_get_num_enums(ms->ctl);
+    table = calloc(1, sizeof(*table) + num_enums * sizeof(table->names[0]));
+    if (!table) {
+        ALOGE("Unable to allocate enum table for ctl %s", ar->ops->ctl_get_name(ms->ctl));
+        pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+        return NULL;
+    }
+    table->num_enums = num_enums;
+
+    for (i = 0; i < num_enums; i++) {
+        table->names[i] = ar->ops->ctl_get_enum_string(ms->ctl, i);
+        /* duplicate names resolve to the first one, as the linear search did */
+        if (!table->names[i] ||
+            name_index_find(&table->index, table->names[i], enum_table_get_name, table) >= 0)
+            continue;
+        if (name_index_add(&table->index, table->names[i], i) < 0) {
+            name_index_free(&table->index);
+            free(table);
+            pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+            return NULL;
+        }
+    }
+
+    __atomic_store_n(&ms->enums, table, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+    return table;
+}
+
+static void enum_table_free(struct mixer_state *ms)
+{
+    if (ms->enums) {
+        name_index_free(&ms->enums->index);
+        free(ms->enums);
+        ms->enums = NULL;
+    }
+}
+
+/* value of an enum string, or -1 if the control has no such enum */
+static int enum_string_to_value(struct audio_route *ar, unsigned int ctl_index,
+                                const char *string)
+{
+    struct enum_table *table = enum_table_get(ar, ctl_index);
+
+    if (!table)
+        return -1;
+
+    return name_index_find(&table->index, string, enum_table_get_name, table);
+}
+
+static int mixer_enum_string_to_value(struct audio_route *ar, unsigned int ctl_index,
+                                      const char *string)
+{
+    struct mixer_ctl *ctl = index_to_ctl(ar, ctl_index);
+    int value;
+
+    if (string == NULL) {
+        ALOGE("NULL enum value string passed to mixer_enum_string_to_value() for ctl %s",
+              ar->ops->ctl_get_name(ctl));
+        return 0;
+    }
+
+    value = enum_string_to_value(ar, ctl_index, string);
+    if (value < 0) {
+        ALOGW("unknown enum value string %s for ctl %s",
+              string, ar->ops->ctl_get_name(ctl));
+        return 0;
+    }
+    return value;
+}
+
+/*
+ * Parse the next number of a space separated value list like strtol(), base 0
+ * accepting 0x hex and 0 octal prefixes. Returns the end of the number's
+ * token, or NULL if the list has no more numbers.
+ */
+static const char *parse_number(const char *str, unsigned int base, long *value)
+{
+    unsigned long number = 0;
+    unsigned int digit;
+    bool negative = false;
+
+    while (*str == ' ')
+        str++;
+    if (*str == '\0')
+        return NULL;
+
+    if (*str == '-' || *str == '+')
+        negative = *str++ == '-';
+    if ((base == 0 || base == 16) && str[0] == '0' && (str[1] | 0x20) == 'x' &&
+        isxdigit((unsigned char)str[2])) {
+        str += 2;
+        base = 16;
+    } else if (base == 0) {
+        base = str[0] == '0' ? 8 : 10;
+    }
+
+    for (;; str++) {
+        if (*str >= '0' && *str <= '9')
+            digit = *str - '0';
+        else if ((*str | 0x20) >= 'a' && (*str | 0x20) <= 'f')
+            digit = (*str | 0x20) - 'a' + 10;
+        else
+            break;
+        if (digit >= base)
+            break;
+        number = number * base + digit;
+    }
+    *value = negative ? -(long)number : (long)number;
+
+    /* anything after the digits is ignored up to the next space */
+    while (*str != '\0' && *str != ' ')
+        str++;
+    return str;
+}
+
+/*
+ * Parse num_values values of a BYTE (hex) or INT ctl into the parse buffer of
+ * state, in the control's value type. Returns the number of values found.
+ */
+static unsigned int parse_ctl_values(struct config_parse_state *state,
+                                     enum mixer_ctl_type type, const char *str,
+                                     unsigned int num_values)
+{
+    size_t size = num_values * sizeof_ctl_type(type);
+    unsigned int i;
+    long value;
+
+    if (size > state->values_size) {
+        void *values = realloc(state->values, size);
+
+        if (!values) {
+            ALOGE("%s: unable to allocate", __func__);
+            return 0;
+        }
+        state->values = values;
+        state->values_size = size;
+    }
+
+    for (i = 0; i < num_values; i++) {
+        str = parse_number(str, type == MIXER_CTL_TYPE_BYTE ? 16 : 0, &value);
+        if (!str)
+            break;
+        if (type == MIXER_CTL_TYPE_BYTE)
+            ((unsigned char *)state->values)[i] = value;
+        else
+            ((long *)state->values)[i] = value;
+    }
+
+    return i;
+}
+
+static void start_tag(void *data, const XML_Char *tag_name,
+                      const XML_Char **attr)
+{
+    const XML_Char *attr_name = NULL;
+    const XML_Char *attr_id = NULL;
+    const XML_Char *attr_value = NULL;
+    struct config_parse_state *state = data;
+    struct audio_route *ar = state->ar;
+    unsigned int i;
+    int ctl_index;
+    struct mixer_ctl *ctl;
+    long value;
+    unsigned int id;
+    struct mixer_value mixer_value;
+    enum mixer_ctl_type type;
+    union ctl_values values = { .ptr = NULL };
+
+    /* Get name, id and value attributes (these may be empty) */
+    for (i = 0; attr[i]; i += 2) {
+        if (strcmp(attr[i], "name") == 0)
+            attr_name = attr[i + 1];
+        else if (strcmp(attr[i], "id") == 0)
+            attr_id = attr[i + 1];
+        else if (strcmp(attr[i], "value") == 0)
+            attr_value = attr[i + 1];
+    }
+
+    /* Look at tags */
+    if (strcmp(tag_name, "path") == 0) {
+        if (attr_name == NULL) {
+            ALOGE("Unnamed path!");
+        } else {
+            if (state->level == 1) {
+                /* top level path: create and stash the path */
+                state->path = path_create(ar, (char *)attr_name);
+                if (state->path == NULL)
+                    ALOGW("path creation failed, please check if the path exists");
+            } else {
+                /* nested path */
+                struct mixer_path *sub_path = db_get_path(ar->builder.db, attr_name);
+                if (!sub_path) {
+                    ALOGW("unable to find sub path '%s'", attr_name);
+                } else if (state->path != NULL) {
+                    path_add_path(ar, state->path, sub_path);
+                }
+            }
+        }
+    } else if (strcmp(tag_name, "ctl") == 0) {
+        if (state->level == 1 && state->reload)
+            goto done;
+
+        /* Obtain the mixer ctl and value */
+        ctl_index = ctl_get_index_by_name(ar, attr_name);
+        if (ctl_index < 0) {
+            ALOGW("Control '%s' doesn't exist - skipping", attr_name);
+            goto done;
+        }
+        ctl = index_to_ctl(ar, ctl_index);
+
+        switch (ar->mixer_state[ctl_index].type) {
+        case MIXER_CTL_TYPE_BOOL:
+            if (attr_value == NULL) {
+                ALOGE("No value specified for ctl %s", attr_name);
+                goto done;
+            }
+            value = strtol((char *)attr_value, NULL, 0);
+            break;
+        case MIXER_CTL_TYPE_INT:
+        case MIXER_CTL_TYPE_BYTE: {
+                if (attr_value == NULL) {
+                    ALOGE("No value specified for ctl %s", attr_name);
+                    goto done;
+                }
+                /* with an id, only the first value is used */
+                unsigned int num_values = attr_id ? 1 : ar->ops->ctl_get_num_values(ctl);
+                i = parse_ctl_values(state, ar->mixer_state[ctl_index].type, attr_value,
+                                     num_values);
+                if (i < num_values) {
+                    ALOGE("expect %d values but only %d specified for ctl %s",
+                        num_values, i, attr_name);
+                    goto done;
+                }
+                values.ptr = state->values;
+                if (ar->mixer_state[ctl_index].type == MIXER_CTL_TYPE_BYTE)
+                    value = values.bytes[0];
+                else
+                    value = values.integer[0];
+            } break;
+        case MIXER_CTL_TYPE_ENUM:
+            if (attr_value == NULL) {
+                ALOGE("No value specified for ctl %s", attr_name);
+                goto done;
+            }
+            value = mixer_enum_string_to_value(ar, ctl_index, (char *)attr_value);
+            break;
+        default:
+            value = 0;
+            break;
+        }
+
+        if (state->level == 1) {
+            /* top level ctl (initial setting) */
+
+            type = ar->mixer_state[ctl_index].type;
+            if (is_supported_ctl_type(type)) {
+                load_ctl(ar, ctl_index);
+                mark_ctl_dirty(ar, ctl_index);
+                /* apply the new value */
+                if (attr_id) {
+                    /* set only one value */
+                    id = atoi((char *)attr_id);
+                    if (id < ar->mixer_state[ctl_index].num_values) {
+                        builder_add_init(ar, ctl_index, id);
+                        if (type == MIXER_CTL_TYPE_BYTE)
+                            ar->mixer_state[ctl_index].new_value.bytes[id] = value;
+                        else if (type == MIXER_CTL_TYPE_ENUM)
+                            ar->mixer_state[ctl_index].new_value.enumerated[id] = value;
+                        else
+                            ar->mixer_state[ctl_index].new_value.integer[id] = value;
+                    } else {
+                        ALOGW("value id out of range for mixer ctl '%s'",
+                              ar->ops->ctl_get_name(ctl));
+                    }
+                } else {
+                    builder_add_init(ar, ctl_index, -1);
+                    /* set all values the same except for CTL_TYPE_BYTE and CTL_TYPE_INT */
+                    if (type == MIXER_CTL_TYPE_BYTE || type == MIXER_CTL_TYPE_INT) {
+                        memcpy(ar->mixer_state[ctl_index].new_value.ptr, values.ptr,
+                               ctl_values_size(&ar->mixer_state[ctl_index]));
+                    } else {
+                        for (i = 0; i < ar->mixer_state[ctl_index].num_values; i++)
+                            if (type == MIXER_CTL_TYPE_ENUM)
+                                ar->mixer_state[ctl_index].new_value.enumerated[i] = value;
+                            else
+                                ar->mixer_state[ctl_index].new_value.integer[i] = value;
+                    }
+                }
+            }
+        } else {
+            /* nested ctl (within a path) */
+            mixer_value.ctl_index = ctl_index;
+            mixer_value.value = value;
+            mixer_value.values = values;
+            if (attr_id)
+                mixer_value.index = atoi((char *)attr_id);
+            else
+                mixer_value.index = -1;
+            if (state->path != NULL)
+                path_add_value(ar, state->path, &mixer_value);
+        }
+    }
+
+done:
+    state->level++;
+}
+
+static void end_tag(void *data, const XML_Char *tag_name)
+{
+    struct config_parse_state *state = data;
+
+    state->level--;
+
+    /* a top level path is complete */
+    if (state->level == 1 && strcmp(tag_name, "path") == 0)
+        path_seal(state->ar);
+}
+
+static void free_mixer_state(struct audio_route *ar);
+
+static int alloc_mixer_state(struct audio_route *ar)
+{
+    unsigned int i;
+    unsigned int num_values;
+    struct mixer_ctl *ctl;
+    enum mixer_ctl_type type;
+
+    ar->num_mixer_ctls = ar->ops->get_num_ctls(ar->mixer);
+    ar->mixer_state = calloc(ar->num_mixer_ctls, sizeof(struct mixer_state));
+    if (!ar->mixer_state)
+        return -1;
+
+    ar->dirty_ctls = calloc(DIRTY_WORDS(ar->num_mixer_ctls), sizeof(uint64_t));
+    ar->pending_map = calloc(DIRTY_WORDS(ar->num_mixer_ctls), sizeof(uint64_t));
+    ar->pending_ctls = calloc(ar->num_mixer_ctls, sizeof(unsigned int));
+    ar->ctl_mark = calloc(ar->num_mixer_ctls, sizeof(unsigned int));
+    if (!ar->dirty_ctls || !ar->pending_map ||
+        (ar->num_mixer_ctls && (!ar->pending_ctls || !ar->ctl_mark))) {
+        free(ar->dirty_ctls);
+        free(ar->pending_map);
+        free(ar->pending_ctls);
+        free(ar->ctl_mark);
+        free(ar->mixer_state);
+        ar->mixer_state = NULL;
+        return -1;
+    }
+
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        ctl = ar->ops->get_ctl(ar->mixer, i);
+        num_values = ar->ops->ctl_get_num_values(ctl);
+
+        ar->mixer_state[i].ctl = ctl;
+        ar->mixer_state[i].num_values = num_values;
+        ar->mixer_state[i].active_count = 0;
+
+        /* Skip unsupported types that are not supported yet in XML */
+        type = ar->ops->ctl_get_type(ctl);
+        ar->mixer_state[i].type = type;
+
+        if (!is_supported_ctl_type(type))
+            continue;
+
+        /* the current values are read by load_ctl() when first needed */
+        size_t value_sz = sizeof_ctl_type(type);
+        ar->mixer_state[i].value_size = value_sz;
+        if (type == MIXER_CTL_TYPE_ENUM)
+            ar->mixer_state[i].write_kind = CTL_WRITE_VALUE;
+        else if (ar->ops->ctl_set_array_range &&
+                 (type == MIXER_CTL_TYPE_INT || type == MIXER_CTL_TYPE_BYTE))
+            ar->mixer_state[i].write_kind = CTL_WRITE_RANGE;
+        else
+            ar->mixer_state[i].write_kind = CTL_WRITE_ARRAY;
+        ar->mixer_state[i].old_value.ptr = calloc(num_values, value_sz);
+        ar->mixer_state[i].new_value.ptr = calloc(num_values, value_sz);
+        ar->mixer_state[i].reset_value.ptr = calloc(num_values, value_sz);
+        if (num_values && (!ar->mixer_state[i].old_value.ptr ||
+                           !ar->mixer_state[i].new_value.ptr ||
+                           !ar->mixer_state[i].reset_value.ptr)) {
+            ALOGE("%s: unable to allocate values of '%s'", __func__,
+                  ar->ops->ctl_get_name(ctl));
+            free_mixer_state(ar);
+            return -1;
+        }
+    }
+
+    /* index the control names, the first control wins like mixer_get_ctl_by_name() */
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        const char *name = ar->ops->ctl_get_name(ar->mixer_state[i].ctl);
+
+        if (name_index_find(&ar->ctl_index, name, ctl_index_get_name, ar) >= 0)
+            continue;
+        if (name_index_add(&ar->ctl_index, name, i) < 0) {
+            free_mixer_state(ar);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void init_locks(struct audio_route *ar)
+{
+    unsigned int i;
+
+    for (i = 0; i < CTL_LOCK_STRIPES; i++)
+        pthread_mutex_init(&ar->ctl_locks[i], NULL);
+    pthread_mutex_init(&ar->transaction_lock, NULL);
+    pthread_mutex_init(&ar->mark_lock, NULL);
+    pthread_mutex_init(&ar->reload_lock, NULL);
+    pthread_rwlock_init(&ar->states_lock, NULL);
+}
+
+static void destroy_locks(struct audio_route *ar)
+{
+    unsigned int i;
+
+    for (i = 0; i < CTL_LOCK_STRIPES; i++)
+        pthread_mutex_destroy(&ar->ctl_locks[i]);
+    pthread_mutex_destroy(&ar->transaction_lock);
+    pthread_mutex_destroy(&ar->mark_lock);
+    pthread_mutex_destroy(&ar->reload_lock);
+    pthread_rwlock_destroy(&ar->states_lock);
+}
+
+static void free_mixer_state(struct audio_route *ar)
+{
+    unsigned int i;
+    enum mixer_ctl_type type;
+
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        enum_table_free(&ar->mixer_state[i]);
+
+        type = ar->mixer_state[i].type;
+        if (!is_supported_ctl_type(type))
+            continue;
+
+        free(ar->mixer_state[i].old_value.ptr);
+        free(ar->mixer_state[i].new_value.ptr);
+        free(ar->mixer_state[i].reset_value.ptr);
+        free(ar->mixer_state[i].committed_value.ptr);
+    }
+
+    free(ar->mixer_state);
+    ar->mixer_state = NULL;
+    free(ar->dirty_ctls);
+    ar->dirty_ctls = NULL;
+    free(ar->pending_map);
+    ar->pending_map = NULL;
+    free(ar->pending_ctls);
+    ar->pending_ctls = NULL;
+    free(ar->ctl_mark);
+    ar->ctl_mark = NULL;
+    name_index_free(&ar->ctl_index);
+}
+
+/* write a control to the mixer if its value has changed */
+static void update_mixer_ctl(struct audio_route *ar, unsigned int i)
+{
+    struct mixer_state *ms = &ar->mixer_state[i];
+
+    /* Skip unsupported types */
+    if (!ms->value_size)
+        return;
+
+    /* if the value has changed, update the mixer */
+    if (ctl_values_changed(ms)) {
+        write_ctl(ar, i);
+        memcpy(ms->old_value.ptr, ms->new_value.ptr, ctl_values_size(ms));
+    }
+}
+
+static void mixer_update(struct audio_route *ar)
+{
+    unsigned int w;
+    uint64_t dirty;
+
+    /* only controls written since the last update can have changed, walk
+       them in index order as a full scan would */
+    for (w = 0; w < DIRTY_WORDS(ar->num_mixer_ctls); w++) {
+        if (!__atomic_load_n(&ar->dirty_ctls[w], __ATOMIC_RELAXED))
+            continue;
+
+        /* controls marked again from now on are left for the next update */
+        dirty = __atomic_exchange_n(&ar->dirty_ctls[w], 0, __ATOMIC_ACQ_REL);
+        for (; dirty; dirty &= dirty - 1) {
+            unsigned int i = w * DIRTY_WORD_BITS + __builtin_ctzll(dirty);
+
+            pthread_mutex_lock(ctl_lock(ar, i));
+            update_mixer_ctl(ar, i);
+            pthread_mutex_unlock(ctl_lock(ar, i));
+        }
+    }
+}
+
+/* Update the mixer with any changed values */
+int audio_route_update_mixer(struct audio_route *ar)
+{
+    struct route_stats *stats = stats_get(ar, AUDIO_ROUTE_STATS_COUNT |
+                                              AUDIO_ROUTE_STATS_TRACE);
+    uint64_t start;
+
+    if (!stats) {
+        mixer_update(ar);
+        return 0;
+    }
+
+    start = stats_begin(stats, STATS_UPDATE, NULL);
+    mixer_update(ar);
+    stats_end(ar, stats, STATS_UPDATE, NULL, start);
+
+    return 0;
+}
+
+/* saves the current state of the mixer, for resetting all controls */
+static void save_mixer_state(struct audio_route *ar)
+{
+    unsigned int i;
+
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        /* controls not read yet get their reset value when they are */
+        if (!ar->mixer_state[i].loaded)
+            continue;
+
+        memcpy(ar->mixer_state[i].reset_value.ptr, ar->mixer_state[i].new_value.ptr,
+               ctl_values_size(&ar->mixer_state[i]));
+    }
+}
+
+/* Reset the audio routes back to the initial state */
+void audio_route_reset(struct audio_route *ar)
+{
+    struct ref_debug *rd = ref_debug_get(ar);
+    struct path_states *states;
+    unsigned int i;
+
+    pthread_rwlock_rdlock(&ar->states_lock);
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    for (i = 0; i < states->db->num_mixer_paths; i++)
+        __atomic_store_n(&states->active[i], 0, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&ar->states_lock);
+
+    /* no path holds a control any more, and all of the saved values are
+       loaded; controls never read were never changed */
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        pthread_mutex_lock(ctl_lock(ar, i));
+        ar->mixer_state[i].active_count = 0;
+        if (rd)
+            rd->ctls[i].num = 0;
+        if (!ar->mixer_state[i].loaded) {
+            pthread_mutex_unlock(ctl_lock(ar, i));
+            continue;
+        }
+        memcpy(ar->mixer_state[i].new_value.ptr, ar->mixer_state[i].reset_value.ptr,
+               ctl_values_size(&ar->mixer_state[i]));
+        mark_ctl_dirty(ar, i);
+        pthread_mutex_unlock(ctl_lock(ar, i));
+    }
+}
+
+/* Start deferring mixer writes until the matching audio_route_commit() */
+int audio_route_begin(struct audio_route *ar)
+{
+    if (!ar) {
+        ALOGE("invalid audio_route");
+        return -1;
+    }
+
+    if (in_transaction(ar)) {
+        ar->transaction_depth++;
+        return 0;
+    }
+
+    /* transactions of other threads are committed first */
+    pthread_mutex_lock(&ar->transaction_lock);
+    __atomic_store_n(&ar->transaction_owner, pthread_self(), __ATOMIC_RELAXED);
+    ar->transaction_depth = 1;
+    ar->num_pending = 0;
+    ar->num_pending_requests = 0;
+    __atomic_store_n(&ar->transaction_active, true, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Write the controls queued since audio_route_begin(), once each in first write order */
+int audio_route_commit(struct audio_route *ar)
+{
+    struct timespec start, end;
+    unsigned int i;
+    unsigned int num_written = 0;
+    int ret;
+
+    if (!ar || !in_transaction(ar)) {
+        ALOGE("%s: no transaction in progress", __func__);
+        return -1;
+    }
+
+    if (--ar->transaction_depth)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < ar->num_pending; i++) {
+        unsigned int ctl_index = ar->pending_ctls[i];
+        struct mixer_state *ms = &ar->mixer_state[ctl_index];
+
+        pthread_mutex_lock(ctl_lock(ar, ctl_index));
+        __atomic_fetch_and(&ar->pending_map[ctl_index / DIRTY_WORD_BITS],
+                           ~((uint64_t)1 << (ctl_index % DIRTY_WORD_BITS)), __ATOMIC_RELAXED);
+        /* skip controls whose queued writes cancel out */
+        if (ms->committed_value.ptr &&
+            memcmp(ms->committed_value.ptr, ms->old_value.ptr, ctl_values_size(ms)) == 0) {
+            pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+            continue;
+        }
+
+        ret = mixer_ctl_write(ar, ms, ms->old_value, ms->committed_value.ptr);
+        pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+        if (ret < 0)
+            ALOGE("%s: failed to write mixer control '%s': %d", __func__,
+                  ar->ops->ctl_get_name(ms->ctl), ret);
+        num_written++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ALOGD("%s: %u control writes for %u requests in %ld us", __func__, num_written,
+          ar->num_pending_requests,
+          (long)((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000));
+
+    ar->num_pending = 0;
+    ar->num_pending_requests = 0;
+    __atomic_store_n(&ar->transaction_active, false, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ar->transaction_lock);
+
+    return num_written;
+}
+
+/*
+ * Close the caller's transaction without writing. The controls go back to
+ * the values the mixer has, and stay dirty for the next mixer update.
+ */
+static void transaction_abort(struct audio_route *ar)
+{
+    unsigned int i;
+
+    for (i = 0; i < ar->num_pending; i++) {
+        unsigned int ctl_index = ar->pending_ctls[i];
+        struct mixer_state *ms = &ar->mixer_state[ctl_index];
+
+        pthread_mutex_lock(ctl_lock(ar, ctl_index));
+        __atomic_fetch_and(&ar->pending_map[ctl_index / DIRTY_WORD_BITS],
+                           ~((uint64_t)1 << (ctl_index % DIRTY_WORD_BITS)), __ATOMIC_RELAXED);
+        if (ms->committed_value.ptr)
+            memcpy(ms->old_value.ptr, ms->committed_value.ptr, ctl_values_size(ms));
+        mark_ctl_dirty(ar, ctl_index);
+        pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+    }
+
+    ar->num_pending = 0;
+    ar->num_pending_requests = 0;
+    ar->transaction_depth = 0;
+    __atomic_store_n(&ar->transaction_active, false, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ar->transaction_lock);
+}
+
+/* Look up an audio route path by name */
+struct mixer_path *audio_route_get_path(struct audio_route *ar, const char *name)
+{
+    struct route_stats *stats;
+    struct mixer_path *path;
+    uint64_t start;
+
+    if (!ar) {
+        ALOGE("invalid audio_route");
+        return NULL;
+    }
+
+    stats = stats_get(ar, AUDIO_ROUTE_STATS_COUNT);
+    if (stats) {
+        start = stats_begin(stats, STATS_LOOKUP, name);
+        path = path_get_by_name(ar, name);
+        stats_end(ar, stats, STATS_LOOKUP, path, start);
+    } else {
+        path = path_get_by_name(ar, name);
+    }
+    if (!path)
+        ALOGE("unable to find path '%s'", name);
+
+    return path;
+}
+
+int audio_route_get_enum_value(struct audio_route *ar, const char *ctl_name,
+                               const char *string)
+{
+    int ctl_index;
+
+    if (!ar || !ctl_name || !string) {
+        ALOGE("%s: invalid parameter", __func__);
+        return -1;
+    }
+
+    ctl_index = ctl_get_index_by_name(ar, ctl_name);
+    if (ctl_index < 0) {
+        ALOGE("%s: unable to find ctl '%s'", __func__, ctl_name);
+        return -1;
+    }
+
+    if (ar->mixer_state[ctl_index].type != MIXER_CTL_TYPE_ENUM) {
+        ALOGE("%s: ctl '%s' is not an enum", __func__, ctl_name);
+        return -1;
+    }
+
+    return enum_string_to_value(ar, ctl_index, string);
+}
+
+/* Choose how a control is written: whole, or only its changed span */
+int audio_route_set_ctl_write_mode(struct audio_route *ar, const char *ctl_name,
+                                   enum audio_route_write_mode mode)
+{
+    int ctl_index;
+
+    if (!ar || !ctl_name) {
+        ALOGE("invalid audio_route or control");
+        return -1;
+    }
+
+    ctl_index = ctl_get_index_by_name(ar, ctl_name);
+    if (ctl_index < 0) {
+        ALOGE("%s: unable to find control '%s'", __func__, ctl_name);
+        return -1;
+    }
+
+    ar->mixer_state[ctl_index].write_mode = mode;
+    return 0;
+}
+
+int audio_route_apply_path_by_handle(struct audio_route *ar, struct mixer_path *path)
+{
+    struct route_stats *stats;
+    uint64_t start;
+
+    if (!ar || !path) {
+        ALOGE("invalid audio_route or path");
+        return -1;
+    }
+
+    stats = stats_get(ar, AUDIO_ROUTE_STATS_COUNT | AUDIO_ROUTE_STATS_TRACE);
+    if (stats) {
+        start = stats_begin(stats, STATS_APPLY, path->name);
+        path_apply(ar, path);
+        stats_end(ar, stats, STATS_APPLY, path, start);
+    } else {
+        path_apply(ar, path);
+    }
+    path_state_apply(ar, path);
+
+    return 0;
+}
+
+/* Apply an audio route path by name */
+int audio_route_apply_path(struct audio_route *ar, const char *name)
+{
+    struct mixer_path *path = audio_route_get_path(ar, name);
+
+    if (!path)
+        return -1;
+
+    return audio_route_apply_path_by_handle(ar, path);
+}
+
+/* Reset an audio route path by handle */
+int audio_route_reset_path_by_handle(struct audio_route *ar, struct mixer_path *path)
+{
+    struct route_stats *stats;
+    uint64_t start;
+
+    if (!ar || !path) {
+        ALOGE("invalid audio_route or path");
+        return -1;
+    }
+
+    stats = stats_get(ar, AUDIO_ROUTE_STATS_COUNT | AUDIO_ROUTE_STATS_TRACE);
+    if (stats) {
+        start = stats_begin(stats, STATS_RESET, path->name);
+        path_reset(ar, path);
+        stats_end(ar, stats, STATS_RESET, path, start);
+    } else {
+        path_reset(ar, path);
+    }
+    path_state_reset(ar, path, false);
+
+    return 0;
+}
+
+/* Reset an audio route path by name */
+int audio_route_reset_path(struct audio_route *ar, const char *name)
+{
+    struct mixer_path *path = audio_route_get_path(ar, name);
+
+    if (!path)
+        return -1;
+
+    return audio_route_reset_path_by_handle(ar, path);
+}
+
+/* update one control of a path, see audio_route_update_path() */
+static void update_path_ctl(struct audio_route *ar, struct mixer_path *path,
+                            unsigned int ctl_index, int direction)
+{
+    bool reverse = direction != DIRECTION_FORWARD;
+    bool force_reset = direction == DIRECTION_REVERSE_RESET;
+    struct mixer_state * ms = &ar->mixer_state[ctl_index];
+
+    if (!ms->value_size) {
+        return;
+    }
+
+    pthread_mutex_lock(ctl_lock(ar, ctl_index));
+    if (reverse)
+        ctl_ref_put(ar, ctl_index, path, force_reset);
+    else
+        ctl_ref_get(ar, ctl_index, path);
+
+    /* if any value has changed, update the mixer */
+    if (ctl_values_changed(ms)) {
+        if (reverse && ms->active_count > 0) {
+            ALOGD("%s: skip to reset mixer control '%s' in path '%s' "
+                "because it is still needed by other paths", __func__,
+                ar->ops->ctl_get_name(ms->ctl), path->name);
+            memcpy(ms->new_value.ptr, ms->old_value.ptr, ctl_values_size(ms));
+        } else {
+            write_ctl(ar, ctl_index);
+            memcpy(ms->old_value.ptr, ms->new_value.ptr, ctl_values_size(ms));
+        }
+    }
+    pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+}
+
+/*
+ * Operates on the specified path .. controls will be updated in the
+ * order listed in the XML file
+ */
+static void path_update(struct audio_route *ar, struct mixer_path *path, int direction)
+{
+    bool reverse = direction != DIRECTION_FORWARD;
+
+    for (size_t i = 0; i < path->length; ++i)
+        update_path_ctl(ar, path,
+                        path->op[reverse ? path->length - 1 - i : i].ctl_index,
+                        direction);
+}
+
+static int audio_route_update_path(struct audio_route *ar, struct mixer_path *path,
+                                   int direction)
+{
+    struct route_stats *stats = stats_get(ar, AUDIO_ROUTE_STATS_COUNT |
+                                              AUDIO_ROUTE_STATS_TRACE);
+    uint64_t start;
+
+    if (!stats) {
+        path_update(ar, path, direction);
+        return 0;
+    }
+
+    start = stats_begin(stats, STATS_UPDATE, path->name);
+    path_update(ar, path, direction);
+    stats_end(ar, stats, STATS_UPDATE, path, start);
+
+    return 0;
+}
+
+int audio_route_apply_and_update_path_by_handle(struct audio_route *ar,
+                                                struct mixer_path *path)
+{
+    if (audio_route_apply_path_by_handle(ar, path) < 0) {
+        return -1;
+    }
+    return audio_route_update_path(ar, path, DIRECTION_FORWARD);
+}
+
+int audio_route_apply_and_update_path(struct audio_route *ar, const char *name)
+{
+    return audio_route_apply_and_update_path_by_handle(ar, audio_route_get_path(ar, name));
+}
+
+int audio_route_reset_and_update_path_by_handle(struct audio_route *ar,
+                                                struct mixer_path *path)
+{
+    if (audio_route_reset_path_by_handle(ar, path) < 0) {
+        return -1;
+    }
+    return audio_route_update_path(ar, path, DIRECTION_REVERSE);
+}
+
+int audio_route_reset_and_update_path(struct audio_route *ar, const char *name)
+{
+    return audio_route_reset_and_update_path_by_handle(ar, audio_route_get_path(ar, name));
+}
+
+int audio_route_force_reset_and_update_path_by_handle(struct audio_route *ar,
+                                                      struct mixer_path *path)
+{
+    if (audio_route_reset_path_by_handle(ar, path) < 0) {
+        return -1;
+    }
+    path_state_reset(ar, path, true);
+
+    return audio_route_update_path(ar, path, DIRECTION_REVERSE_RESET);
+}
+
+int audio_route_force_reset_and_update_path(struct audio_route *ar, const char *name)
+{
+    return audio_route_force_reset_and_update_path_by_handle(ar, audio_route_get_path(ar, name));
+}
+
+/* start a new marking of ctl_mark, called with mark_lock held */
+static unsigned int mark_begin(struct audio_route *ar)
+{
+    unsigned int generation = ++ar->mark_generation;
+
+    if (generation == 0) {
+        memset(ar->ctl_mark, 0, ar->num_mixer_ctls * sizeof(unsigned int));
+        generation = ar->mark_generation = 1;
+    }
+    return generation;
+}
+
+static int path_switch(struct audio_route *ar, struct mixer_path *from,
+                       struct mixer_path *to)
+{
+    bool shared_buf[SWITCH_SHARED_BUF_SIZE];
+    bool *shared = shared_buf;
+    unsigned int generation;
+    unsigned int i;
+
+    if (from->length > SWITCH_SHARED_BUF_SIZE) {
+        shared = malloc(from->length * sizeof(bool));
+        if (!shared) {
+            ALOGE("%s: unable to allocate", __func__);
+            return -1;
+        }
+    }
+
+    /* mark the controls of the new path, then note which old ones are shared */
+    pthread_mutex_lock(&ar->mark_lock);
+    generation = mark_begin(ar);
+    for (i = 0; i < to->length; i++)
+        ar->ctl_mark[to->op[i].ctl_index] = generation;
+    for (i = 0; i < from->length; i++)
+        shared[i] = ar->ctl_mark[from->op[i].ctl_index] == generation;
+    pthread_mutex_unlock(&ar->mark_lock);
+
+    /*
+     * Reset the old path like audio_route_reset_and_update_path(), except
+     * for the controls the new path sets again: those only drop the old
+     * path's reference and are written once, with their final value, when
+     * the new path is applied.
+     */
+    for (i = from->length; i-- > 0;) {
+        unsigned int ctl_index = from->op[i].ctl_index;
+        struct mixer_state *ms = &ar->mixer_state[ctl_index];
+
+        pthread_mutex_lock(ctl_lock(ar, ctl_index));
+        if (shared[i]) {
+            ctl_ref_put(ar, ctl_index, from, false);
+            pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+            continue;
+        }
+
+        load_ctl(ar, ctl_index);
+        memcpy(ms->new_value.ptr, ms->reset_value.ptr, ctl_values_size(ms));
+        mark_ctl_dirty(ar, ctl_index);
+        pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+        update_path_ctl(ar, from, ctl_index, DIRECTION_REVERSE);
+    }
+    if (shared != shared_buf)
+        free(shared);
+
+    path_apply(ar, to);
+    path_update(ar, to, DIRECTION_FORWARD);
+    return 0;
+}
+
+/* accounted as one update of the new path */
+int audio_route_switch_path_by_handle(struct audio_route *ar, struct mixer_path *from,
+                                      struct mixer_path *to)
+{
+    struct route_stats *stats;
+    uint64_t start;
+    int ret;
+
+    if (!ar || !from || !to) {
+        ALOGE("invalid audio_route or path");
+        return -1;
+    }
+
+    stats = stats_get(ar, AUDIO_ROUTE_STATS_COUNT | AUDIO_ROUTE_STATS_TRACE);
+    if (!stats) {
+        ret = path_switch(ar, from, to);
+    } else {
+        start = stats_begin(stats, STATS_UPDATE, to->name);
+        ret = path_switch(ar, from, to);
+        stats_end(ar, stats, STATS_UPDATE, to, start);
+    }
+    if (ret == 0) {
+        path_state_reset(ar, from, false);
+        path_state_apply(ar, to);
+    }
+
+    return ret;
+}
+
+int audio_route_switch_path(struct audio_route *ar, const char *from, const char *to)
+{
+    struct mixer_path *from_path = audio_route_get_path(ar, from);
+    struct mixer_path *to_path = audio_route_get_path(ar, to);
+
+    if (!from_path || !to_path)
+        return -1;
+
+    return audio_route_switch_path_by_handle(ar, from_path, to_path);
+}
+
+/*
+ * List the controls of a set of paths once each, in the order they are first
+ * updated: forward through the paths when applying, backward when resetting.
+ */
+static unsigned int path_set_ctls(struct audio_route *ar, struct mixer_path *const paths[],
+                                  unsigned int num_paths, bool reverse, unsigned int *ctls)
+{
+    unsigned int generation;
+    unsigned int num_ctls = 0;
+    unsigned int p, i;
+
+    pthread_mutex_lock(&ar->mark_lock);
+    generation = mark_begin(ar);
+    for (p = 0; p < num_paths; p++) {
+        struct mixer_path *path = paths[reverse ? num_paths - 1 - p : p];
+
+        for (i = 0; i < path->length; i++) {
+            unsigned int ctl_index = path->op[reverse ? path->length - 1 - i : i].ctl_index;
+
+            if (ar->ctl_mark[ctl_index] == generation)
+                continue;
+            ar->ctl_mark[ctl_index] = generation;
+            ctls[num_ctls++] = ctl_index;
+        }
+    }
+    pthread_mutex_unlock(&ar->mark_lock);
+
+    return num_ctls;
+}
+
+/*
+ * Apply or reset a set of paths and update the mixer in one pass. The paths
+ * are applied in order, so a control set by several paths gets the value of
+ * the last one, and is written once. Each path still holds its own reference
+ * on its controls, as if it was applied or reset on its own.
+ */
+static int path_set_update(struct audio_route *ar, struct route_stats *stats,
+                           struct mixer_path *const paths[], unsigned int num_paths,
+                           int direction)
+{
+    bool reverse = direction != DIRECTION_FORWARD;
+    enum stats_op op = reverse ? STATS_RESET : STATS_APPLY;
+    unsigned int ctls_buf[PATH_SET_CTLS_BUF_SIZE];
+    unsigned int *ctls = ctls_buf;
+    size_t max_ctls = 0;
+    unsigned int num_ctls;
+    unsigned int p, i;
+    uint64_t start = 0;
+
+    for (p = 0; p < num_paths; p++)
+        max_ctls += paths[p]->length;
+    if (max_ctls > PATH_SET_CTLS_BUF_SIZE) {
+        ctls = malloc(max_ctls * sizeof(unsigned int));
+        if (!ctls) {
+            ALOGE("%s: unable to allocate", __func__);
+            return -1;
+        }
+    }
+
+    for (p = 0; p < num_paths; p++) {
+        if (stats)
+            start = stats_begin(stats, op, paths[p]->name);
+        if (reverse)
+            path_reset(ar, paths[p]);
+        else
+            path_apply(ar, paths[p]);
+        if (stats)
+            stats_end(ar, stats, op, paths[p], start);
+
+        for (i = 0; i < paths[p]->length; i++) {
+            unsigned int ctl_index = paths[p]->op[i].ctl_index;
+
+            pthread_mutex_lock(ctl_lock(ar, ctl_index));
+            if (reverse)
+                ctl_ref_put(ar, ctl_index, paths[p], false);
+            else
+                ctl_ref_get(ar, ctl_index, paths[p]);
+            pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+        }
+    }
+
+    /* the single update pass counts as an update of every path */
+    if (stats)
+        start = stats_begin(stats, STATS_UPDATE, NULL);
+    num_ctls = path_set_ctls(ar, paths, num_paths, reverse, ctls);
+    for (i = 0; i < num_ctls; i++) {
+        struct mixer_state *ms = &ar->mixer_state[ctls[i]];
+
+        pthread_mutex_lock(ctl_lock(ar, ctls[i]));
+        if (ms->value_size && ctl_values_changed(ms)) {
+            /* like update_path_ctl(), keep controls other paths still need */
+            if (reverse && ms->active_count > 0) {
+                memcpy(ms->new_value.ptr, ms->old_value.ptr, ctl_values_size(ms));
+            } else {
+                write_ctl(ar, ctls[i]);
+                memcpy(ms->old_value.ptr, ms->new_value.ptr, ctl_values_size(ms));
+            }
+        }
+        pthread_mutex_unlock(ctl_lock(ar, ctls[i]));
+    }
+    if (stats)
+        stats_end_paths(ar, stats, STATS_UPDATE, paths, num_paths, start);
+    if (ctls != ctls_buf)
+        free(ctls);
+
+    for (p = 0; p < num_paths; p++) {
+        if (reverse)
+            path_state_reset(ar, paths[p], false);
+        else
+            path_state_apply(ar, paths[p]);
+    }
+
+    return 0;
+}
+
+static int update_paths_by_handle(struct audio_route *ar, struct mixer_path *const paths[],
+                                  unsigned int num_paths, int direction)
+{
+    unsigned int p;
+
+    if (!ar || (!paths && num_paths)) {
+        ALOGE("invalid audio_route or paths");
+        return -1;
+    }
+    for (p = 0; p < num_paths; p++) {
+        if (!paths[p]) {
+            ALOGE("invalid path %u", p);
+            return -1;
+        }
+    }
+
+    return path_set_update(ar, stats_get(ar, AUDIO_ROUTE_STATS_COUNT | AUDIO_ROUTE_STATS_TRACE),
+                           paths, num_paths, direction);
+}
+
+/* look up all names before touching any control, so a bad name changes nothing */
+static int update_paths(struct audio_route *ar, const char *const names[],
+                        unsigned int num_paths, int direction)
+{
+    struct mixer_path *paths_buf[INITIAL_MIXER_PATH_SIZE];
+    struct mixer_path **paths = paths_buf;
+    unsigned int p;
+    int ret = -1;
+
+    if (!ar || (!names && num_paths)) {
+        ALOGE("invalid audio_route or paths");
+        return -1;
+    }
+
+    if (num_paths > INITIAL_MIXER_PATH_SIZE) {
+        paths = malloc(num_paths * sizeof(struct mixer_path *));
+        if (!paths) {
+            ALOGE("%s: unable to allocate", __func__);
+            return -1;
+        }
+    }
+
+    for (p = 0; p < num_paths; p++) {
+        paths[p] = audio_route_get_path(ar, names[p]);
+        if (!paths[p])
+            goto done;
+    }
+    ret = update_paths_by_handle(ar, paths, num_paths, direction);
+
+done:
+    if (paths != paths_buf)
+        free(paths);
+    return ret;
+}
+
+int audio_route_apply_and_update_paths_by_handle(struct audio_route *ar,
+                                                 struct mixer_path *const paths[],
+                                                 unsigned int num_paths)
+{
+    return update_paths_by_handle(ar, paths, num_paths, DIRECTION_FORWARD);
+}
+
+int audio_route_apply_and_update_paths(struct audio_route *ar, const char *const names[],
+                                       unsigned int num_paths)
+{
+    return update_paths(ar, names, num_paths, DIRECTION_FORWARD);
+}
+
+int audio_route_reset_and_update_paths_by_handle(struct audio_route *ar,
+                                                 struct mixer_path *const paths[],
+                                                 unsigned int num_paths)
+{
+    return update_paths_by_handle(ar, paths, num_paths, DIRECTION_REVERSE);
+}
+
+int audio_route_reset_and_update_paths(struct audio_route *ar, const char *const names[],
+                                       unsigned int num_paths)
+{
+    return update_paths(ar, names, num_paths, DIRECTION_REVERSE);
+}
+
+/* statistics api */
+
+static int open_trace_marker(void)
+{
+    int fd = open(TRACE_MARKER_PATH, O_WRONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        fd = open(TRACE_MARKER_DEBUGFS_PATH, O_WRONLY | O_CLOEXEC);
+    return fd;
+}
+
+static void free_stats(struct route_stats *stats)
+{
+    if (!stats)
+        return;
+    if (stats->trace_fd >= 0)
+        close(stats->trace_fd);
+    free(stats->ctls);
+    free(stats);
+}
+
+/* allocate the per path statistics of states unless they already are */
+static int alloc_path_stats(struct path_states *states)
+{
+    struct audio_route_path_stats *ps, *expected = NULL;
+
+    if (__atomic_load_n(&states->stats, __ATOMIC_ACQUIRE) || !states->db->num_mixer_paths)
+        return 0;
+
+    ps = calloc(states->db->num_mixer_paths, sizeof(struct audio_route_path_stats));
+    if (!ps) {
+        ALOGE("%s: unable to allocate", __func__);
+        return -1;
+    }
+    if (!__atomic_compare_exchange_n(&states->stats, &expected, ps, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        free(ps);
+
+    return 0;
+}
+
+int audio_route_enable_stats(struct audio_route *ar, unsigned int flags)
+{
+    struct route_stats *stats, *expected = NULL;
+    int fd, unused = -1;
+    int ret = 0;
+
+    if (!ar || (flags & ~(AUDIO_ROUTE_STATS_COUNT | AUDIO_ROUTE_STATS_TRACE))) {
+        ALOGE("%s: invalid parameter", __func__);
+        return -1;
+    }
+
+    /* allocated on first use and never freed before the audio route, so
+       the update paths need no lock to use it */
+    stats = __atomic_load_n(&ar->stats, __ATOMIC_ACQUIRE);
+    if (!stats) {
+        if (!flags)
+            return 0;
+
+        stats = calloc(1, sizeof(struct route_stats));
+        if (!stats)
+            return -1;
+        stats->trace_fd = -1;
+        stats->ctls = calloc(ar->num_mixer_ctls, sizeof(struct ctl_stats));
+        if (ar->num_mixer_ctls && !stats->ctls) {
+            ALOGE("%s: unable to allocate", __func__);
+            free_stats(stats);
+            return -1;
+        }
+
+        if (!__atomic_compare_exchange_n(&ar->stats, &expected, stats, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free_stats(stats);
+            stats = expected;
         }
-    } else {
-        /* set only one value */
-        if (path->setting[path_index].type == MIXER_CTL_TYPE_BYTE)
-            path->setting[path_index].value.bytes[mixer_value->index] = mixer_value->value;
-        else if (path->setting[path_index].type == MIXER_CTL_TYPE_ENUM)
-            path->setting[path_index].value.enumerated[mixer_value->index] = mixer_value->value;
-        else
-            path->setting[path_index].value.integer[mixer_value->index] = mixer_value->value;
     }
 
+    if (flags & AUDIO_ROUTE_STATS_COUNT) {
+        ret = alloc_path_stats(__atomic_load_n(&ar->states, __ATOMIC_ACQUIRE));
+        if (ret < 0)
+            return ret;
+    }
+
+    if ((flags & AUDIO_ROUTE_STATS_TRACE) &&
+        __atomic_load_n(&stats->trace_fd, __ATOMIC_ACQUIRE) < 0) {
+        fd = open_trace_marker();
+        if (fd < 0) {
+            ALOGW("%s: unable to open trace_marker: %s", __func__, strerror(errno));
+            flags &= ~AUDIO_ROUTE_STATS_TRACE;
+            ret = -1;
+        } else if (!__atomic_compare_exchange_n(&stats->trace_fd, &unused, fd, false,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            close(fd);
+        }
+    }
+
+    __atomic_store_n(&stats->flags, flags, __ATOMIC_RELEASE);
+    return ret;
+}
+
+static void copy_latency(struct audio_route_latency *to, const struct audio_route_latency *from)
+{
+    unsigned int i;
+
+    to->count = __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+    to->total_ns = __atomic_load_n(&from->total_ns, __ATOMIC_RELAXED);
+    to->max_ns = __atomic_load_n(&from->max_ns, __ATOMIC_RELAXED);
+    for (i = 0; i < AUDIO_ROUTE_STATS_BUCKETS; i++)
+        to->hist[i] = __atomic_load_n(&from->hist[i], __ATOMIC_RELAXED);
+}
+
+int audio_route_get_stats(struct audio_route *ar, struct audio_route_stats *stats)
+{
+    struct route_stats *rs;
+
+    if (!ar || !stats) {
+        ALOGE("%s: invalid parameter", __func__);
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    rs = __atomic_load_n(&ar->stats, __ATOMIC_ACQUIRE);
+    if (!rs)
+        return 0;
+
+    copy_latency(&stats->lookup, &rs->op[STATS_LOOKUP]);
+    copy_latency(&stats->apply, &rs->op[STATS_APPLY]);
+    copy_latency(&stats->reset, &rs->op[STATS_RESET]);
+    copy_latency(&stats->update, &rs->op[STATS_UPDATE]);
+    copy_latency(&stats->ctl_write, &rs->ctl_write);
     return 0;
 }
 
-static int path_add_path(struct audio_route *ar, struct mixer_path *path,
-                         struct mixer_path *sub_path)
+int audio_route_get_path_stats(struct audio_route *ar, const char *name,
+                               struct audio_route_path_stats *stats)
+{
+    struct audio_route_path_stats *ps;
+    struct path_states *states;
+    struct mixer_path *path;
+    int i;
+
+    if (!ar || !name || !stats) {
+        ALOGE("%s: invalid parameter", __func__);
+        return -1;
+    }
+
+    path = path_get_by_name(ar, name);
+    if (!path) {
+        ALOGE("%s: unable to find path '%s'", __func__, name);
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    ps = __atomic_load_n(&states->stats, __ATOMIC_ACQUIRE);
+    i = path_state_index(states, path);
+    if (!ps || i < 0)
+        return 0;
+
+    ps += i;
+    stats->applies = __atomic_load_n(&ps->applies, __ATOMIC_RELAXED);
+    stats->resets = __atomic_load_n(&ps->resets, __ATOMIC_RELAXED);
+    stats->updates = __atomic_load_n(&ps->updates, __ATOMIC_RELAXED);
+    stats->update_ns = __atomic_load_n(&ps->update_ns, __ATOMIC_RELAXED);
+    stats->max_update_ns = __atomic_load_n(&ps->max_update_ns, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int audio_route_get_slowest_ctls(struct audio_route *ar, struct audio_route_ctl_stats *stats,
+                                 unsigned int n)
+{
+    struct audio_route_ctl_stats entry;
+    struct route_stats *rs;
+    unsigned int i, j, count = 0;
+
+    if (!ar || (n && !stats)) {
+        ALOGE("%s: invalid parameter", __func__);
+        return -1;
+    }
+
+    rs = __atomic_load_n(&ar->stats, __ATOMIC_ACQUIRE);
+    if (!rs)
+        return 0;
+
+    /* insertion into the n slowest so far */
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        entry.writes = __atomic_load_n(&rs->ctls[i].writes, __ATOMIC_RELAXED);
+        if (!entry.writes)
+            continue;
+        entry.total_ns = __atomic_load_n(&rs->ctls[i].total_ns, __ATOMIC_RELAXED);
+        entry.max_ns = __atomic_load_n(&rs->ctls[i].max_ns, __ATOMIC_RELAXED);
+
+        for (j = count; j > 0 && stats[j - 1].max_ns < entry.max_ns; j--)
+            if (j < n)
+                stats[j] = stats[j - 1];
+        if (j >= n)
+            continue;
+        entry.name = ar->ops->ctl_get_name(ar->mixer_state[i].ctl);
+        stats[j] = entry;
+        if (count < n)
+            count++;
+    }
+
+    return count;
+}
+
+/* not atomic with respect to updates running meanwhile */
+void audio_route_reset_stats(struct audio_route *ar)
+{
+    struct path_states *states;
+    struct audio_route_path_stats *ps;
+    struct route_stats *rs;
+
+    if (!ar)
+        return;
+
+    rs = __atomic_load_n(&ar->stats, __ATOMIC_ACQUIRE);
+    if (!rs)
+        return;
+
+    memset(rs->op, 0, sizeof(rs->op));
+    memset(&rs->ctl_write, 0, sizeof(rs->ctl_write));
+    memset(rs->ctls, 0, ar->num_mixer_ctls * sizeof(struct ctl_stats));
+
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    ps = __atomic_load_n(&states->stats, __ATOMIC_ACQUIRE);
+    if (ps)
+        memset(ps, 0, states->db->num_mixer_paths * sizeof(*ps));
+}
+
+/* reference api */
+
+static void free_ref_debug(struct ref_debug *rd, unsigned int num_ctls)
 {
     unsigned int i;
 
-    for (i = 0; i < sub_path->length; i++) {
-        int retVal = path_add_setting(ar, path, &sub_path->setting[i]);
-        if (retVal < 0) {
-            if (retVal == -2)
+    if (!rd)
+        return;
+    for (i = 0; i < num_ctls; i++)
+        free(rd->ctls[i].holder);
+    free(rd->ctls);
+    free(rd);
+}
+
+int audio_route_enable_ref_debug(struct audio_route *ar, int enable)
+{
+    struct ref_debug *rd, *expected = NULL;
+    struct path_states *states;
+    unsigned int i, j;
+
+    if (!ar) {
+        ALOGE("%s: invalid audio_route", __func__);
+        return -1;
+    }
+
+    /* allocated on first use and never freed before the audio route */
+    rd = __atomic_load_n(&ar->ref_debug, __ATOMIC_ACQUIRE);
+    if (!rd) {
+        if (!enable)
+            return 0;
+
+        rd = calloc(1, sizeof(struct ref_debug));
+        if (!rd)
+            return -1;
+        rd->ctls = calloc(ar->num_mixer_ctls, sizeof(struct ctl_holders));
+        if (ar->num_mixer_ctls && !rd->ctls) {
+            ALOGE("%s: unable to allocate", __func__);
+            free(rd);
+            return -1;
+        }
+
+        if (!__atomic_compare_exchange_n(&ar->ref_debug, &expected, rd, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free_ref_debug(rd, ar->num_mixer_ctls);
+            rd = expected;
+        }
+    }
+
+    if (!enable || __atomic_load_n(&rd->enabled, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&rd->enabled, enable != 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    /* references taken so far are attributed to the applied paths, and the
+       rest to an unknown holder */
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        pthread_mutex_lock(ctl_lock(ar, i));
+        rd->ctls[i].num = 0;
+        pthread_mutex_unlock(ctl_lock(ar, i));
+    }
+    for (i = 0; i < states->db->num_mixer_paths; i++) {
+        const struct mixer_path *path = &states->db->mixer_path[i];
+        unsigned int count = __atomic_load_n(&states->active[i], __ATOMIC_RELAXED);
+
+        for (j = 0; count && j < path->length; j++) {
+            pthread_mutex_lock(ctl_lock(ar, path->op[j].ctl_index));
+            holder_add(&rd->ctls[path->op[j].ctl_index], path, count);
+            pthread_mutex_unlock(ctl_lock(ar, path->op[j].ctl_index));
+        }
+    }
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        unsigned int held = 0;
+
+        pthread_mutex_lock(ctl_lock(ar, i));
+        for (j = 0; j < rd->ctls[i].num; j++)
+            held += rd->ctls[i].holder[j].count;
+        if (held > ar->mixer_state[i].active_count)
+            rd->ctls[i].num = 0;
+        else if (held < ar->mixer_state[i].active_count)
+            holder_add(&rd->ctls[i], NULL, ar->mixer_state[i].active_count - held);
+        pthread_mutex_unlock(ctl_lock(ar, i));
+    }
+    __atomic_store_n(&rd->enabled, true, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+unsigned long audio_route_get_ref_errors(struct audio_route *ar)
+{
+    struct ref_debug *rd;
+
+    if (!ar)
+        return 0;
+
+    rd = __atomic_load_n(&ar->ref_debug, __ATOMIC_ACQUIRE);
+    return rd ? __atomic_load_n(&rd->errors, __ATOMIC_RELAXED) : 0;
+}
+
+int audio_route_get_active_paths(struct audio_route *ar, struct audio_route_path_refs *paths,
+                                 unsigned int n)
+{
+    struct path_states *states;
+    unsigned int i, count = 0;
+
+    if (!ar || (n && !paths)) {
+        ALOGE("%s: invalid parameter", __func__);
+        return -1;
+    }
+
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    for (i = 0; i < states->db->num_mixer_paths && count < n; i++) {
+        paths[count].count = __atomic_load_n(&states->active[i], __ATOMIC_RELAXED);
+        if (!paths[count].count)
+            continue;
+        paths[count].name = states->db->mixer_path[i].name;
+        count++;
+    }
+
+    return count;
+}
+
+/* holders of a control, recorded or else the applied paths setting it */
+static unsigned int ctl_get_holders(struct audio_route *ar, unsigned int ctl_index,
+                                    struct audio_route_path_refs *holders, unsigned int n)
+{
+    struct ref_debug *rd = ref_debug_get(ar);
+    struct path_states *states;
+    unsigned int i, j, count = 0;
+
+    if (rd) {
+        for (i = 0; i < rd->ctls[ctl_index].num && count < n; i++, count++) {
+            holders[count].name = holder_name(rd->ctls[ctl_index].holder[i].path);
+            holders[count].count = rd->ctls[ctl_index].holder[i].count;
+        }
+        return count;
+    }
+
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    for (i = 0; i < states->db->num_mixer_paths && count < n; i++) {
+        const struct mixer_path *path = &states->db->mixer_path[i];
+        unsigned int active = __atomic_load_n(&states->active[i], __ATOMIC_RELAXED);
+
+        for (j = 0; active && j < path->length; j++) {
+            if (path->op[j].ctl_index != ctl_index)
                 continue;
-            else
-                return -1;
+            holders[count].name = path->name;
+            holders[count].count = active;
+            count++;
+            break;
+        }
+    }
+
+    return count;
+}
+
+int audio_route_get_ctl_refs(struct audio_route *ar, const char *ctl_name,
+                             unsigned int *refs, struct audio_route_path_refs *holders,
+                             unsigned int n)
+{
+    int ctl_index;
+    unsigned int count;
+
+    if (!ar || !ctl_name || (n && !holders)) {
+        ALOGE("%s: invalid parameter", __func__);
+        return -1;
+    }
+
+    ctl_index = ctl_get_index_by_name(ar, ctl_name);
+    if (ctl_index < 0) {
+        ALOGE("%s: unknown control '%s'", __func__, ctl_name);
+        return -1;
+    }
+
+    pthread_mutex_lock(ctl_lock(ar, ctl_index));
+    if (refs)
+        *refs = ar->mixer_state[ctl_index].active_count;
+    count = ctl_get_holders(ar, ctl_index, holders, n);
+    pthread_mutex_unlock(ctl_lock(ar, ctl_index));
+
+    return count;
+}
+
+void audio_route_dump_refs(struct audio_route *ar, int fd)
+{
+    struct audio_route_path_refs holders[REF_DUMP_HOLDERS];
+    struct path_states *states;
+    unsigned int i, j, refs, count;
+
+    if (!ar)
+        return;
+
+    states = __atomic_load_n(&ar->states, __ATOMIC_ACQUIRE);
+    dprintf(fd, "active paths:\n");
+    for (i = 0; i < states->db->num_mixer_paths; i++) {
+        count = __atomic_load_n(&states->active[i], __ATOMIC_RELAXED);
+        if (count)
+            dprintf(fd, "  %s: %u\n", states->db->mixer_path[i].name, count);
+    }
+
+    dprintf(fd, "control references:\n");
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        pthread_mutex_lock(ctl_lock(ar, i));
+        refs = ar->mixer_state[i].active_count;
+        count = refs ? ctl_get_holders(ar, i, holders, REF_DUMP_HOLDERS) : 0;
+        pthread_mutex_unlock(ctl_lock(ar, i));
+        if (!refs)
+            continue;
+
+        dprintf(fd, "  %s: %u", ar->ops->ctl_get_name(ar->mixer_state[i].ctl), refs);
+        for (j = 0; j < count; j++)
+            dprintf(fd, "%s%s %u", j ? ", " : " (", holders[j].name, holders[j].count);
+        dprintf(fd, "%s\n", count ? ")" : "");
+    }
+
+    if (ref_debug_get(ar))
+        dprintf(fd, "reference errors: %lu\n", audio_route_get_ref_errors(ar));
+}
+
+/* asynchronous updates */
+
+struct route_request {
+    struct route_request *next;
+    int id;
+    uint64_t deadline;
+    audio_route_done_t done;
+    void *cookie;
+    /* controls touched by the request, later requests sharing one wait */
+    uint64_t *ctls;
+    unsigned int num_ops;
+    struct audio_route_op ops[];
+};
+
+struct route_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    /* signalled when a request is queued or the worker should stop */
+    pthread_cond_t queued;
+    /* signalled when the queue has drained */
+    pthread_cond_t idle;
+    struct route_request *head;
+    unsigned int num_busy;
+    unsigned int next_id;
+    bool stop;
+    int event_fd;
+    /* controls of requests ahead of the one being considered */
+    uint64_t *seen;
+};
+
+/* whether the caller is the worker thread, e.g. in a done callback */
+static inline bool on_worker(struct audio_route *ar)
+{
+    return ar->worker && pthread_equal(ar->worker->thread, pthread_self());
+}
+
+static int run_route_op(struct audio_route *ar, const struct audio_route_op *op)
+{
+    switch (op->type) {
+    case AUDIO_ROUTE_OP_APPLY:
+        return audio_route_apply_and_update_path_by_handle(ar, op->path);
+    case AUDIO_ROUTE_OP_RESET:
+        return audio_route_reset_and_update_path_by_handle(ar, op->path);
+    case AUDIO_ROUTE_OP_FORCE_RESET:
+        return audio_route_force_reset_and_update_path_by_handle(ar, op->path);
+    case AUDIO_ROUTE_OP_SWITCH:
+        return audio_route_switch_path_by_handle(ar, op->from, op->path);
+    }
+    return -1;
+}
+
+static int run_route_request(struct audio_route *ar, const struct route_request *req)
+{
+    unsigned int i;
+    int ret = 0;
+
+    /* one transaction, so controls changed by several ops are written once */
+    audio_route_begin(ar);
+    for (i = 0; i < req->num_ops; i++) {
+        if (run_route_op(ar, &req->ops[i]) < 0)
+            ret = -1;
+    }
+    if (audio_route_commit(ar) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+/*
+ * Take the queued request to run next, with the worker lock held: the one
+ * with the earliest deadline among those that share no control with a
+ * request queued before them, or the oldest if none has a deadline.
+ */
+static struct route_request *route_request_next(struct audio_route *ar)
+{
+    struct route_worker *worker = ar->worker;
+    struct route_request **best = NULL;
+    struct route_request **link;
+    struct route_request *req;
+    unsigned int num_words = DIRTY_WORDS(ar->num_mixer_ctls);
+    uint64_t best_deadline = UINT64_MAX;
+    unsigned int w;
+
+    memset(worker->seen, 0, num_words * sizeof(uint64_t));
+    for (link = &worker->head; *link; link = &(*link)->next) {
+        uint64_t deadline = (*link)->deadline ? (*link)->deadline : UINT64_MAX;
+        bool blocked = false;
+
+        for (w = 0; w < num_words; w++) {
+            if ((*link)->ctls[w] & worker->seen[w])
+                blocked = true;
+            worker->seen[w] |= (*link)->ctls[w];
+        }
+
+        if (!best || (!blocked && deadline < best_deadline)) {
+            best = link;
+            best_deadline = deadline;
         }
     }
+
+    req = *best;
+    *best = req->next;
+    return req;
+}
+
+static void *route_worker_main(void *data)
+{
+    struct audio_route *ar = data;
+    struct route_worker *worker = ar->worker;
+    struct route_request *req;
+    uint64_t one = 1;
+    int ret;
+
+    pthread_mutex_lock(&worker->lock);
+    for (;;) {
+        while (!worker->head && !worker->stop)
+            pthread_cond_wait(&worker->queued, &worker->lock);
+        if (!worker->head)
+            break;
+
+        req = route_request_next(ar);
+        pthread_mutex_unlock(&worker->lock);
+
+        ret = run_route_request(ar, req);
+        if (req->done)
+            req->done(req->cookie, req->id, ret);
+        if (write(worker->event_fd, &one, sizeof(one)) < 0)
+            ALOGW("%s: unable to signal request %d: %s", __func__, req->id, strerror(errno));
+        free(req);
+
+        pthread_mutex_lock(&worker->lock);
+        if (--worker->num_busy == 0)
+            pthread_cond_broadcast(&worker->idle);
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return NULL;
+}
+
+int audio_route_start_worker(struct audio_route *ar)
+{
+    struct route_worker *worker;
+
+    if (!ar) {
+        ALOGE("invalid audio_route");
+        return -1;
+    }
+
+    if (ar->worker)
+        return 0;
+
+    worker = calloc(1, sizeof(struct route_worker));
+    if (!worker)
+        goto err_calloc;
+
+    worker->seen = calloc(DIRTY_WORDS(ar->num_mixer_ctls), sizeof(uint64_t));
+    if (!worker->seen)
+        goto err_seen;
+
+    worker->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (worker->event_fd < 0) {
+        ALOGE("%s: unable to create eventfd: %s", __func__, strerror(errno));
+        goto err_eventfd;
+    }
+
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->queued, NULL);
+    pthread_cond_init(&worker->idle, NULL);
+    worker->next_id = 1;
+
+    ar->worker = worker;
+    if (pthread_create(&worker->thread, NULL, route_worker_main, ar) != 0) {
+        ALOGE("%s: unable to create worker thread", __func__);
+        ar->worker = NULL;
+        goto err_thread;
+    }
+
     return 0;
+
+err_thread:
+    pthread_cond_destroy(&worker->idle);
+    pthread_cond_destroy(&worker->queued);
+    pthread_mutex_destroy(&worker->lock);
+    close(worker->event_fd);
+err_eventfd:
+    free(worker->seen);
+err_seen:
+    free(worker);
+err_calloc:
+    return -1;
 }
 
-static int path_apply(struct audio_route *ar, struct mixer_path *path)
+int audio_route_get_worker_fd(struct audio_route *ar)
+{
+    if (!ar || !ar->worker)
+        return -1;
+
+    return ar->worker->event_fd;
+}
+
+static int route_request_add_path(struct route_request *req, const struct mixer_path *path)
 {
     unsigned int i;
-    unsigned int ctl_index;
-    struct mixer_ctl *ctl;
-    enum mixer_ctl_type type;
 
-    ALOGD("Apply path: %s", path->name != NULL ? path->name : "none");
+    if (!path) {
+        ALOGE("%s: invalid path", __func__);
+        return -1;
+    }
+
     for (i = 0; i < path->length; i++) {
-        ctl_index = path->setting[i].ctl_index;
-        ctl = index_to_ctl(ar, ctl_index);
-        type = mixer_ctl_get_type(ctl);
-        if (!is_supported_ctl_type(type))
-            continue;
-        size_t value_sz = sizeof_ctl_type(type);
-        memcpy(ar->mixer_state[ctl_index].new_value.ptr, path->setting[i].value.ptr,
-                   path->setting[i].num_values * value_sz);
+        unsigned int ctl_index = path->op[i].ctl_index;
+
+        req->ctls[ctl_index / DIRTY_WORD_BITS] |= (uint64_t)1 << (ctl_index % DIRTY_WORD_BITS);
+    }
+
+    return 0;
+}
+
+int audio_route_submit(struct audio_route *ar, const struct audio_route_op *ops,
+                       unsigned int num_ops, uint64_t deadline,
+                       audio_route_done_t done, void *cookie)
+{
+    struct route_worker *worker;
+    struct route_request *req;
+    struct route_request **link;
+    size_t ops_size = num_ops * sizeof(struct audio_route_op);
+    unsigned int i;
+    int id;
+
+    if (!ar || !ar->worker || (!ops && num_ops)) {
+        ALOGE("%s: invalid audio_route or no worker", __func__);
+        return -1;
+    }
+    worker = ar->worker;
+
+    /* the op array and the control bitmap follow the request */
+    req = calloc(1, sizeof(struct route_request) + ops_size +
+                 DIRTY_WORDS(ar->num_mixer_ctls) * sizeof(uint64_t));
+    if (!req) {
+        ALOGE("%s: unable to allocate request", __func__);
+        return -1;
+    }
+    memcpy(req->ops, ops, ops_size);
+    req->ctls = (uint64_t *)((char *)req->ops + ops_size);
+    req->num_ops = num_ops;
+    req->deadline = deadline;
+    req->done = done;
+    req->cookie = cookie;
+
+    for (i = 0; i < num_ops; i++) {
+        if (route_request_add_path(req, ops[i].path) < 0 ||
+            (ops[i].type == AUDIO_ROUTE_OP_SWITCH &&
+             route_request_add_path(req, ops[i].from) < 0)) {
+            free(req);
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&worker->lock);
+    id = req->id = worker->next_id++;
+    if (worker->next_id > INT32_MAX)
+        worker->next_id = 1;
+    for (link = &worker->head; *link; link = &(*link)->next)
+        ;
+    *link = req;
+    worker->num_busy++;
+    pthread_cond_signal(&worker->queued);
+    pthread_mutex_unlock(&worker->lock);
+
+    return id;
+}
+
+int audio_route_flush(struct audio_route *ar)
+{
+    struct route_worker *worker;
+
+    if (!ar || !ar->worker)
+        return -1;
+    worker = ar->worker;
+
+    /* the worker runs requests in transactions, it would wait for ours */
+    if (in_transaction(ar)) {
+        ALOGE("%s: called inside a transaction", __func__);
+        return -EDEADLK;
     }
+    /* from done, the request running counts as busy until done returns */
+    if (on_worker(ar)) {
+        ALOGE("%s: called from the worker thread", __func__);
+        return -EDEADLK;
+    }
+
+    pthread_mutex_lock(&worker->lock);
+    while (worker->num_busy)
+        pthread_cond_wait(&worker->idle, &worker->lock);
+    pthread_mutex_unlock(&worker->lock);
 
     return 0;
 }
 
-static int path_reset(struct audio_route *ar, struct mixer_path *path)
+/* run the requests still queued, then stop the worker */
+static void stop_worker(struct audio_route *ar)
 {
-    unsigned int i;
-    unsigned int ctl_index;
-    struct mixer_ctl *ctl;
-    enum mixer_ctl_type type;
+    struct route_worker *worker = ar->worker;
+
+    if (!worker)
+        return;
+
+    pthread_mutex_lock(&worker->lock);
+    worker->stop = true;
+    pthread_cond_signal(&worker->queued);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+
+    pthread_cond_destroy(&worker->idle);
+    pthread_cond_destroy(&worker->queued);
+    pthread_mutex_destroy(&worker->lock);
+    close(worker->event_fd);
+    free(worker->seen);
+    free(worker);
+    ar->worker = NULL;
+}
 
-    ALOGV("Reset path: %s", path->name != NULL ? path->name : "none");
-    for (i = 0; i < path->length; i++) {
-        ctl_index = path->setting[i].ctl_index;
-        ctl = index_to_ctl(ar, ctl_index);
-        type = mixer_ctl_get_type(ctl);
-        if (!is_supported_ctl_type(type))
-            continue;
-        size_t value_sz = sizeof_ctl_type(type);
-        /* reset the value(s) */
-        memcpy(ar->mixer_state[ctl_index].new_value.ptr,
-               ar->mixer_state[ctl_index].reset_value.ptr,
-               ar->mixer_state[ctl_index].num_values * value_sz);
+/* parsed path cache */
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    /* 64 bit FNV-1a */
+    const unsigned char *p = data;
+
+    while (size--) {
+        hash ^= *p++;
+        hash *= 1099511628211ull;
     }
 
-    return 0;
+    return hash;
 }
 
-/* mixer helper function */
-static int mixer_enum_string_to_value(struct mixer_ctl *ctl, const char *string)
+#define HASH_INIT 14695981039346656037ull
+
+/* fingerprint of the card's control list, the cache holds control indices */
+static uint64_t hash_mixer_ctls(struct audio_route *ar)
 {
+    uint64_t hash = HASH_INIT;
     unsigned int i;
-    unsigned int num_values = mixer_ctl_get_num_enums(ctl);
 
-    if (string == NULL) {
-        ALOGE("NULL enum value string passed to mixer_enum_string_to_value() for ctl %s",
-              mixer_ctl_get_name(ctl));
-        return 0;
+    for (i = 0; i < ar->num_mixer_ctls; i++) {
+        struct mixer_ctl *ctl = ar->mixer_state[i].ctl;
+        const char *name = ar->ops->ctl_get_name(ctl);
+        uint32_t info[3];
+
+        info[0] = ar->mixer_state[i].type;
+        info[1] = ar->mixer_state[i].num_values;
+        info[2] = info[0] == MIXER_CTL_TYPE_ENUM ? ar->ops->ctl_get_num_enums(ctl) : 0;
+        hash = hash_bytes(hash, name, strlen(name) + 1);
+        hash = hash_bytes(hash, info, sizeof(info));
     }
 
-    /* Search the enum strings for a particular one */
-    for (i = 0; i < num_values; i++) {
-        if (strcmp(mixer_ctl_get_enum_string(ctl, i), string) == 0)
-            break;
-    }
-    if (i == num_values) {
-        ALOGW("unknown enum value string %s for ctl %s",
-              string, mixer_ctl_get_name(ctl));
-        return 0;
-    }
-    return i;
+    return hash;
 }
 
-static void start_tag(void *data, const XML_Char *tag_name,
-                      const XML_Char **attr)
+static inline uint64_t cache_align(uint64_t size)
+{
+    return (size + ROUTE_CACHE_ALIGN - 1) & ~(uint64_t)(ROUTE_CACHE_ALIGN - 1);
+}
+
+/* only initial settings of a path cache may cover part of a control */
+static bool cache_setting_valid(struct audio_route *ar, const struct route_cache_header *hdr,
+                                const struct route_cache_setting *setting, bool partial)
 {
-    const XML_Char *attr_name = NULL;
-    const XML_Char *attr_id = NULL;
-    const XML_Char *attr_value = NULL;
-    struct config_parse_state *state = data;
-    struct audio_route *ar = state->ar;
-    unsigned int i;
-    unsigned int ctl_index;
-    struct mixer_ctl *ctl;
-    long value;
-    unsigned int id;
-    struct mixer_value mixer_value;
     enum mixer_ctl_type type;
-    long* value_array = NULL;
+    unsigned int num_values;
+    uint64_t size;
 
-    /* Get name, id and value attributes (these may be empty) */
-    for (i = 0; attr[i]; i += 2) {
-        if (strcmp(attr[i], "name") == 0)
-            attr_name = attr[i + 1];
-        else if (strcmp(attr[i], "id") == 0)
-            attr_id = attr[i + 1];
-        else if (strcmp(attr[i], "value") == 0)
-            attr_value = attr[i + 1];
-    }
+    if (setting->ctl_index >= ar->num_mixer_ctls)
+        return false;
 
-    /* Look at tags */
-    if (strcmp(tag_name, "path") == 0) {
-        if (attr_name == NULL) {
-            ALOGE("Unnamed path!");
-        } else {
-            if (state->level == 1) {
-                /* top level path: create and stash the path */
-                state->path = path_create(ar, (char *)attr_name);
-                if (state->path == NULL)
-                    ALOGW("path creation failed, please check if the path exists");
-            } else {
-                /* nested path */
-                struct mixer_path *sub_path = path_get_by_name(ar, attr_name);
-                if (!sub_path) {
-                    ALOGW("unable to find sub path '%s'", attr_name);
-                } else if (state->path != NULL) {
-                    path_add_path(ar, state->path, sub_path);
-                }
-            }
-        }
-    } else if (strcmp(tag_name, "ctl") == 0) {
-        /* Obtain the mixer ctl and value */
-        ctl = mixer_get_ctl_by_name(ar->mixer, attr_name);
-        if (ctl == NULL) {
-            ALOGW("Control '%s' doesn't exist - skipping", attr_name);
-            goto done;
-        }
+    type = ar->mixer_state[setting->ctl_index].type;
+    num_values = ar->mixer_state[setting->ctl_index].num_values;
+    if (setting->type != (uint32_t)type || !is_supported_ctl_type(type))
+        return false;
+    if (partial ? (!setting->num_values || setting->index > num_values ||
+                   setting->num_values > num_values - setting->index) :
+                  (setting->index || setting->num_values != num_values))
+        return false;
 
-        switch (mixer_ctl_get_type(ctl)) {
-        case MIXER_CTL_TYPE_BOOL:
-            if (attr_value == NULL) {
-                ALOGE("No value specified for ctl %s", attr_name);
-                goto done;
-            }
-            value = strtol((char *)attr_value, NULL, 0);
-            break;
-        case MIXER_CTL_TYPE_INT:
-        case MIXER_CTL_TYPE_BYTE: {
-                char *attr_sub_value, *test_r;
+    size = (uint64_t)setting->num_values * sizeof_ctl_type(type);
+    return setting->value_offset >= hdr->values_offset &&
+           setting->value_offset <= hdr->file_size &&
+           size <= hdr->file_size - setting->value_offset;
+}
 
-                if (attr_value == NULL) {
-                    ALOGE("No value specified for ctl %s", attr_name);
-                    goto done;
-                }
-                unsigned int num_values = mixer_ctl_get_num_values(ctl);
-                value_array = calloc(num_values, sizeof(long));
-                if (!value_array) {
-                    ALOGE("failed to allocate mem for ctl %s", attr_name);
-                    goto done;
-                }
-                for (i = 0; i < num_values; i++) {
-                    attr_sub_value = strtok_r((char *)attr_value, " ", &test_r);
-                    if (attr_sub_value == NULL) {
-                        ALOGE("expect %d values but only %d specified for ctl %s",
-                            num_values, i, attr_name);
-                        goto done;
-                    }
-                    if (mixer_ctl_get_type(ctl) == MIXER_CTL_TYPE_INT)
-                        value_array[i] = strtol((char *)attr_sub_value, NULL, 0);
-                    else
-                        value_array[i] =
-                           (unsigned char) strtol((char *)attr_sub_value, NULL, 16);
+/* check every table entry before anything in the audio route is touched */
+static bool cache_valid(struct audio_route *ar, const void *map, size_t map_size,
+                        uint32_t magic, uint64_t source_hash, uint64_t ctl_hash)
+{
+    const struct route_cache_header *hdr = map;
+    const struct route_cache_path *paths;
+    const struct route_cache_setting *settings;
+    const char *strings;
+    uint64_t tables_end;
+    unsigned int i;
 
-                    if (attr_id)
-                        break;
+    if (map_size < sizeof(*hdr) ||
+        hdr->magic != magic || hdr->version != ROUTE_CACHE_VERSION ||
+        hdr->long_size != sizeof(long) || hdr->file_size != map_size ||
+        hdr->source_hash != source_hash || hdr->ctl_hash != ctl_hash ||
+        hdr->num_ctls != ar->num_mixer_ctls ||
+        hdr->data_hash != hash_bytes(HASH_INIT, hdr + 1, map_size - sizeof(*hdr)))
+        return false;
 
-                    attr_value = NULL;
-                }
-            } break;
-        case MIXER_CTL_TYPE_ENUM:
-            if (attr_value == NULL) {
-                ALOGE("No value specified for ctl %s", attr_name);
-                goto done;
-            }
-            value = mixer_enum_string_to_value(ctl, (char *)attr_value);
-            break;
-        default:
-            value = 0;
-            break;
-        }
+    tables_end = sizeof(*hdr) + (uint64_t)hdr->num_paths * sizeof(*paths) +
+                 (uint64_t)hdr->num_settings * sizeof(*settings);
+    if (hdr->num_init > hdr->num_settings || tables_end > hdr->strings_offset ||
+        hdr->strings_offset > hdr->values_offset || hdr->values_offset > hdr->file_size)
+        return false;
 
-        /* locate the mixer ctl in the list */
-        for (ctl_index = 0; ctl_index < ar->num_mixer_ctls; ctl_index++) {
-            if (ar->mixer_state[ctl_index].ctl == ctl)
-                break;
-        }
+    paths = (const void *)((const char *)map + sizeof(*hdr));
+    settings = (const void *)(paths + hdr->num_paths);
+    strings = (const char *)map + hdr->strings_offset;
 
-        if (state->level == 1) {
-            /* top level ctl (initial setting) */
+    for (i = 0; i < hdr->num_settings; i++)
+        if (!cache_setting_valid(ar, hdr, &settings[i],
+                                 magic == ROUTE_CACHE_MAGIC && i < hdr->num_init))
+            return false;
 
-            type = mixer_ctl_get_type(ctl);
-            if (is_supported_ctl_type(type)) {
-                /* apply the new value */
-                if (attr_id) {
-                    /* set only one value */
-                    id = atoi((char *)attr_id);
-                    if (id < ar->mixer_state[ctl_index].num_values)
-                        if (type == MIXER_CTL_TYPE_BYTE)
-                            ar->mixer_state[ctl_index].new_value.bytes[id] = value_array[0];
-                        else if (type == MIXER_CTL_TYPE_INT)
-                            ar->mixer_state[ctl_index].new_value.integer[id] = value_array[0];
-                        else if (type == MIXER_CTL_TYPE_ENUM)
-                            ar->mixer_state[ctl_index].new_value.enumerated[id] = value;
-                        else
-                            ar->mixer_state[ctl_index].new_value.integer[id] = value;
-                    else
-                        ALOGW("value id out of range for mixer ctl '%s'",
-                              mixer_ctl_get_name(ctl));
-                } else {
-                    /* set all values the same except for CTL_TYPE_BYTE and CTL_TYPE_INT */
-                    for (i = 0; i < ar->mixer_state[ctl_index].num_values; i++)
-                        if (type == MIXER_CTL_TYPE_BYTE)
-                            ar->mixer_state[ctl_index].new_value.bytes[i] = value_array[i];
-                        else if (type == MIXER_CTL_TYPE_INT)
-                            ar->mixer_state[ctl_index].new_value.integer[i] = value_array[i];
-                        else if (type == MIXER_CTL_TYPE_ENUM)
-                            ar->mixer_state[ctl_index].new_value.enumerated[i] = value;
-                        else
-                            ar->mixer_state[ctl_index].new_value.integer[i] = value;
-                }
-            }
-        } else {
-            /* nested ctl (within a path) */
-            mixer_value.ctl_index = ctl_index;
-            if (mixer_ctl_get_type(ctl) == MIXER_CTL_TYPE_BYTE ||
-                mixer_ctl_get_type(ctl) == MIXER_CTL_TYPE_INT) {
-                mixer_value.values = value_array;
-                mixer_value.value = value_array[0];
-            } else {
-                mixer_value.value = value;
-            }
-            if (attr_id)
-                mixer_value.index = atoi((char *)attr_id);
-            else
-                mixer_value.index = -1;
-            if (state->path != NULL)
-                path_add_value(ar, state->path, &mixer_value);
-        }
+    for (i = 0; i < hdr->num_paths; i++) {
+        uint64_t name_end = hdr->strings_offset + paths[i].name_offset;
+
+        if (paths[i].first_setting < hdr->num_init ||
+            paths[i].first_setting > hdr->num_settings ||
+            paths[i].num_settings > hdr->num_settings - paths[i].first_setting ||
+            name_end >= hdr->values_offset ||
+            !memchr(strings + paths[i].name_offset, '\0', hdr->values_offset - name_end))
+            return false;
     }
 
-done:
-    free(value_array);
-    state->level++;
+    return true;
 }
 
-static void end_tag(void *data, const XML_Char *tag_name)
+static const char *map_file(const char *path, size_t min_size, size_t *size)
 {
-    struct config_parse_state *state = data;
-    (void)tag_name;
+    struct stat st;
+    void *map;
+    int fd;
 
-    state->level--;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0 || st.st_size < (off_t)min_size) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *size = st.st_size;
+    return map;
 }
 
-static int alloc_mixer_state(struct audio_route *ar)
+/* write to a temporary file and rename it so readers never see a partial file */
+static int write_file(const char *path, const void *buf, size_t size)
 {
-    unsigned int i;
-    unsigned int num_values;
-    struct mixer_ctl *ctl;
-    enum mixer_ctl_type type;
+    size_t tmp_len = strlen(path) + 32;
+    char *tmp_path;
+    size_t written;
+    FILE *file;
+    int ret = -1;
 
-    ar->num_mixer_ctls = mixer_get_num_ctls(ar->mixer);
-    ar->mixer_state = calloc(ar->num_mixer_ctls, sizeof(struct mixer_state));
-    if (!ar->mixer_state)
+    tmp_path = malloc(tmp_len);
+    if (!tmp_path)
         return -1;
+    snprintf(tmp_path, tmp_len, "%s.%d.tmp", path, (int)getpid());
 
-    for (i = 0; i < ar->num_mixer_ctls; i++) {
-        ctl = mixer_get_ctl(ar->mixer, i);
-        num_values = mixer_ctl_get_num_values(ctl);
+    file = fopen(tmp_path, "wb");
+    if (!file) {
+        ALOGW("Unable to create %s: %s", tmp_path, strerror(errno));
+        goto done;
+    }
+    written = fwrite(buf, 1, size, file);
+    if (fclose(file) != 0 || written != size || rename(tmp_path, path) < 0) {
+        ALOGW("Unable to write %s: %s", path, strerror(errno));
+        unlink(tmp_path);
+        goto done;
+    }
+    ret = 0;
 
-        ar->mixer_state[i].ctl = ctl;
-        ar->mixer_state[i].num_values = num_values;
-        ar->mixer_state[i].active_count = 0;
+done:
+    free(tmp_path);
+    return ret;
+}
 
-        /* Skip unsupported types that are not supported yet in XML */
-        type = mixer_ctl_get_type(ctl);
+/* settings read from a mapped cache, the values stay in the mapping */
+static struct mixer_setting *cache_settings(struct route_db *db,
+                                            const struct route_cache_setting *cs,
+                                            unsigned int num_settings)
+{
+    struct mixer_setting *setting;
+    unsigned int i;
 
-        if (!is_supported_ctl_type(type))
-            continue;
+    if (!num_settings)
+        return NULL;
 
-        size_t value_sz = sizeof_ctl_type(type);
-        ar->mixer_state[i].old_value.ptr = calloc(num_values, value_sz);
-        ar->mixer_state[i].new_value.ptr = calloc(num_values, value_sz);
-        ar->mixer_state[i].reset_value.ptr = calloc(num_values, value_sz);
+    setting = arena_alloc(&db->path_arena, num_settings * sizeof(*setting), sizeof(void *));
+    if (!setting)
+        return NULL;
 
-        if (type == MIXER_CTL_TYPE_ENUM)
-            ar->mixer_state[i].old_value.enumerated[0] = mixer_ctl_get_value(ctl, 0);
-        else
-            mixer_ctl_get_array(ctl, ar->mixer_state[i].old_value.ptr, num_values);
+    for (i = 0; i < num_settings; i++) {
+        setting[i].ctl_index = cs[i].ctl_index;
+        setting[i].index = cs[i].index;
+        setting[i].num_values = cs[i].num_values;
+        setting[i].type = cs[i].type;
+        setting[i].value.ptr = (void *)(db->map + cs[i].value_offset);
+    }
+
+    return setting;
+}
+
+/* compile a path from a mapped cache, the values stay in the mapping */
+static int cache_path_ops(struct route_db *db, struct mixer_path *path,
+                          const struct route_cache_setting *cs, unsigned int num_settings)
+{
+    struct path_op *op;
+    unsigned int i;
+
+    if (!num_settings)
+        return 0;
 
-        memcpy(ar->mixer_state[i].new_value.ptr, ar->mixer_state[i].old_value.ptr,
-               num_values * value_sz);
+    op = arena_alloc(&db->path_arena, num_settings * sizeof(*op), sizeof(void *));
+    if (!op)
+        return -1;
+
+    for (i = 0; i < num_settings; i++) {
+        op[i].ctl_index = cs[i].ctl_index;
+        op[i].size = cs[i].num_values * sizeof_ctl_type(cs[i].type);
+        op[i].offset = cs[i].value_offset;
     }
+    path->op = op;
+    path->values = (const unsigned char *)db->map;
+    path->length = num_settings;
 
     return 0;
 }
 
-static void free_mixer_state(struct audio_route *ar)
+/*
+ * Build the database from a cache file, 0 on success. The settings point
+ * into the mapping, which the database keeps, so processes using the same
+ * cache share the setting values through the page cache.
+ */
+static int cache_load(struct audio_route *ar, const char *cache_path,
+                      uint64_t xml_hash, uint64_t ctl_hash)
 {
+    struct route_db *db = ar->db;
+    const struct route_cache_header *hdr;
+    const struct route_cache_path *paths;
+    const struct route_cache_setting *settings;
+    const char *map;
+    size_t map_size;
     unsigned int i;
-    enum mixer_ctl_type type;
 
-    for (i = 0; i < ar->num_mixer_ctls; i++) {
-        type = mixer_ctl_get_type(ar->mixer_state[i].ctl);
-        if (!is_supported_ctl_type(type))
-            continue;
+    map = map_file(cache_path, sizeof(struct route_cache_header), &map_size);
+    if (!map)
+        return -1;
 
-        free(ar->mixer_state[i].old_value.ptr);
-        free(ar->mixer_state[i].new_value.ptr);
-        free(ar->mixer_state[i].reset_value.ptr);
+    if (!cache_valid(ar, map, map_size, ROUTE_CACHE_MAGIC, xml_hash, ctl_hash)) {
+        ALOGW("Ignoring stale or invalid mixer path cache %s", cache_path);
+        munmap((void *)map, map_size);
+        return -1;
+    }
+    db->map = map;
+    db->map_size = map_size;
+
+    hdr = (const void *)map;
+    paths = (const void *)(map + sizeof(*hdr));
+    settings = (const void *)(paths + hdr->num_paths);
+
+    /* initial settings first, then the settings of each path */
+    db->init = cache_settings(db, settings, hdr->num_init);
+    if (hdr->num_init && !db->init)
+        goto err;
+    db->num_init = hdr->num_init;
+
+    for (i = 0; i < hdr->num_paths; i++) {
+        struct mixer_path *path = path_alloc(db, map + hdr->strings_offset +
+                                             paths[i].name_offset);
+        if (!path)
+            goto err;
+
+        if (cache_path_ops(db, path, &settings[paths[i].first_setting],
+                           paths[i].num_settings) < 0)
+            goto err;
     }
 
-    free(ar->mixer_state);
-    ar->mixer_state = NULL;
+    return 0;
+
+err:
+    ALOGE("Failed to load mixer path cache %s", cache_path);
+    db_reset(db);
+    return -1;
 }
 
-/* Update the mixer with any changed values */
-int audio_route_update_mixer(struct audio_route *ar)
+static void cache_add_setting(struct route_cache_setting *cs, char *values,
+                              uint64_t *values_size, unsigned int ctl_index,
+                              enum mixer_ctl_type type, unsigned int index,
+                              unsigned int num_values, const void *value)
 {
-    unsigned int i;
-    unsigned int j;
-    struct mixer_ctl *ctl;
+    size_t size = num_values * sizeof_ctl_type(type);
+
+    cs->ctl_index = ctl_index;
+    cs->type = type;
+    cs->num_values = num_values;
+    cs->index = index;
+    cs->value_offset = *values_size;
+    memcpy(values + *values_size, value, size);
+    *values_size += cache_align(size);
+}
 
-    for (i = 0; i < ar->num_mixer_ctls; i++) {
-        unsigned int num_values = ar->mixer_state[i].num_values;
-        enum mixer_ctl_type type;
+/* write the database to a new cache file and move it into place */
+static void cache_store(struct audio_route *ar, const char *cache_path,
+                        uint64_t xml_hash, uint64_t ctl_hash)
+{
+    struct route_cache_header hdr;
+    struct route_cache_path *paths;
+    struct route_cache_setting *settings;
+    char *buf, *strings, *values;
+    uint64_t strings_size = 0, values_size = 0;
+    struct route_db *db = ar->db;
+    unsigned int num_settings = db->num_init;
+    unsigned int i, j, n;
+
+    for (i = 0; i < db->num_init; i++)
+        values_size += cache_align(db->init[i].num_values * sizeof_ctl_type(db->init[i].type));
+    for (i = 0; i < db->num_mixer_paths; i++) {
+        struct mixer_path *path = &db->mixer_path[i];
+
+        strings_size += strlen(path->name) + 1;
+        num_settings += path->length;
+        for (j = 0; j < path->length; j++)
+            values_size += cache_align(path->op[j].size);
+    }
 
-        ctl = ar->mixer_state[i].ctl;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = ROUTE_CACHE_MAGIC;
+    hdr.version = ROUTE_CACHE_VERSION;
+    hdr.long_size = sizeof(long);
+    hdr.num_ctls = ar->num_mixer_ctls;
+    hdr.source_hash = xml_hash;
+    hdr.ctl_hash = ctl_hash;
+    hdr.num_paths = db->num_mixer_paths;
+    hdr.num_settings = num_settings;
+    hdr.num_init = db->num_init;
+    hdr.strings_offset = sizeof(hdr) + (uint64_t)hdr.num_paths * sizeof(*paths) +
+                         (uint64_t)num_settings * sizeof(*settings);
+    hdr.values_offset = cache_align(hdr.strings_offset + strings_size);
+    hdr.file_size = hdr.values_offset + values_size;
+
+    buf = calloc(1, hdr.file_size);
+    if (!buf) {
+        ALOGE("Unable to allocate mixer path cache");
+        return;
+    }
+    paths = (void *)(buf + sizeof(hdr));
+    settings = (void *)(paths + hdr.num_paths);
+    strings = buf + hdr.strings_offset;
+    values = buf;
+    values_size = hdr.values_offset;
+
+    n = 0;
+    for (i = 0; i < db->num_init; i++)
+        cache_add_setting(&settings[n++], values, &values_size, db->init[i].ctl_index,
+                          db->init[i].type, db->init[i].index, db->init[i].num_values,
+                          db->init[i].value.ptr);
+
+    strings_size = 0;
+    for (i = 0; i < db->num_mixer_paths; i++) {
+        struct mixer_path *path = &db->mixer_path[i];
+
+        paths[i].name_offset = strings_size;
+        paths[i].first_setting = n;
+        paths[i].num_settings = path->length;
+        strcpy(strings + strings_size, path->name);
+        strings_size += strlen(path->name) + 1;
+        for (j = 0; j < path->length; j++) {
+            struct mixer_setting setting;
+
+            path_op_setting(ar, path, j, &setting);
+            cache_add_setting(&settings[n++], values, &values_size, setting.ctl_index,
+                              setting.type, setting.index, setting.num_values,
+                              setting.value.ptr);
+        }
+    }
 
-        /* Skip unsupported types */
-        type = mixer_ctl_get_type(ctl);
-        if (!is_supported_ctl_type(type))
-            continue;
+    hdr.data_hash = hash_bytes(HASH_INIT, buf + sizeof(hdr), hdr.file_size - sizeof(hdr));
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    write_file(cache_path, buf, hdr.file_size);
+    free(buf);
+}
+
+static uint64_t boot_id_hash(void)
+{
+    char boot_id[64];
+    size_t len;
+    FILE *file;
+
+    file = fopen(BOOT_ID_PATH, "r");
+    if (!file)
+        return 0;
+    len = fread(boot_id, 1, sizeof(boot_id), file);
+    fclose(file);
+
+    return len ? hash_bytes(HASH_INIT, boot_id, len) : 0;
+}
+
+/*
+ * Seed the mixer values from a snapshot saved during this boot, for the
+ * same control list. Controls not in the snapshot are read on first use.
+ */
+static int snapshot_load(struct audio_route *ar, const char *snapshot_path,
+                         uint64_t ctl_hash)
+{
+    const struct route_cache_header *hdr;
+    const struct route_cache_setting *settings;
+    uint64_t boot_hash = boot_id_hash();
+    const char *map;
+    size_t map_size;
+    unsigned int i;
+
+    if (!boot_hash)
+        return -1;
+
+    map = map_file(snapshot_path, sizeof(struct route_cache_header), &map_size);
+    if (!map)
+        return -1;
 
-        /* if the value has changed, update the mixer */
-        bool changed = false;
-        if (type == MIXER_CTL_TYPE_BYTE) {
-            for (j = 0; j < num_values; j++) {
-                if (ar->mixer_state[i].old_value.bytes[j] != ar->mixer_state[i].new_value.bytes[j]) {
-                    changed = true;
-                    break;
-                }
-            }
-         } else if (type == MIXER_CTL_TYPE_ENUM) {
-             for (j = 0; j < num_values; j++) {
-                 if (ar->mixer_state[i].old_value.enumerated[j]
-                         != ar->mixer_state[i].new_value.enumerated[j]) {
-                     changed = true;
-                     break;
-                 }
-             }
-         } else {
-            for (j = 0; j < num_values; j++) {
-                if (ar->mixer_state[i].old_value.integer[j] != ar->mixer_state[i].new_value.integer[j]) {
-                    changed = true;
-                    break;
-                }
-            }
-        }
-        if (changed) {
-            if (type == MIXER_CTL_TYPE_ENUM)
-                mixer_ctl_set_value(ctl, 0, ar->mixer_state[i].new_value.enumerated[0]);
-            else
-                mixer_ctl_set_array(ctl, ar->mixer_state[i].new_value.ptr, num_values);
+    if (!cache_valid(ar, map, map_size, ROUTE_SNAPSHOT_MAGIC, boot_hash, ctl_hash) ||
+        ((const struct route_cache_header *)map)->num_paths) {
+        ALOGW("Ignoring stale or invalid mixer state snapshot %s", snapshot_path);
+        munmap((void *)map, map_size);
+        return -1;
+    }
 
-            size_t value_sz = sizeof_ctl_type(type);
-            memcpy(ar->mixer_state[i].old_value.ptr, ar->mixer_state[i].new_value.ptr,
-                   num_values * value_sz);
-        }
+    hdr = (const void *)map;
+    settings = (const void *)(map + sizeof(*hdr));
+    for (i = 0; i < hdr->num_settings; i++) {
+        struct mixer_state *ms = &ar->mixer_state[settings[i].ctl_index];
+        size_t size = settings[i].num_values * sizeof_ctl_type(settings[i].type);
+
+        memcpy(ms->old_value.ptr, map + settings[i].value_offset, size);
+        memcpy(ms->new_value.ptr, ms->old_value.ptr, size);
+        memcpy(ms->reset_value.ptr, ms->old_value.ptr, size);
+        ms->loaded = true;
     }
 
+    munmap((void *)map, map_size);
     return 0;
 }
 
-/* saves the current state of the mixer, for resetting all controls */
-static void save_mixer_state(struct audio_route *ar)
+int audio_route_save_snapshot(struct audio_route *ar, const char *snapshot_path)
 {
+    struct route_cache_header hdr;
+    struct route_cache_setting *settings;
+    uint64_t values_size = 0;
+    unsigned int num_settings = 0;
+    unsigned int *ctls;
     unsigned int i;
-    enum mixer_ctl_type type;
+    char *buf;
+    int ret;
 
-    for (i = 0; i < ar->num_mixer_ctls; i++) {
-        type = mixer_ctl_get_type(ar->mixer_state[i].ctl);
-        if (!is_supported_ctl_type(type))
-            continue;
+    if (!ar || !snapshot_path) {
+        ALOGE("%s: invalid parameter", __func__);
+        return -1;
+    }
 
-        size_t value_sz = sizeof_ctl_type(type);
-        memcpy(ar->mixer_state[i].reset_value.ptr, ar->mixer_state[i].new_value.ptr,
-               ar->mixer_state[i].num_values * value_sz);
+    /* inside a transaction old_value holds queued values, not the mixer's */
+    if (__atomic_load_n(&ar->transaction_active, __ATOMIC_ACQUIRE)) {
+        ALOGE("%s: transaction in progress", __func__);
+        return -1;
     }
-}
 
-/* Reset the audio routes back to the initial state */
-void audio_route_reset(struct audio_route *ar)
-{
-    unsigned int i;
-    enum mixer_ctl_type type;
+    ctls = malloc(ar->num_mixer_ctls * sizeof(*ctls));
+    if (!ctls && ar->num_mixer_ctls) {
+        ALOGE("%s: unable to allocate snapshot", __func__);
+        return -1;
+    }
 
-    /* load all of the saved values */
+    /*
+     * Other threads can load more controls meanwhile, so the controls sized
+     * here are the ones stored. The values are copied under lock.
+     */
     for (i = 0; i < ar->num_mixer_ctls; i++) {
-        type = mixer_ctl_get_type(ar->mixer_state[i].ctl);
-        if (!is_supported_ctl_type(type))
+        if (!__atomic_load_n(&ar->mixer_state[i].loaded, __ATOMIC_ACQUIRE))
             continue;
+        ctls[num_settings++] = i;
+        values_size += cache_align(ar->mixer_state[i].num_values *
+                                   sizeof_ctl_type(ar->mixer_state[i].type));
+    }
 
-        size_t value_sz = sizeof_ctl_type(type);
-        memcpy(ar->mixer_state[i].new_value.ptr, ar->mixer_state[i].reset_value.ptr,
-            ar->mixer_state[i].num_values * value_sz);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = ROUTE_SNAPSHOT_MAGIC;
+    hdr.version = ROUTE_CACHE_VERSION;
+    hdr.long_size = sizeof(long);
+    hdr.num_ctls = ar->num_mixer_ctls;
+    hdr.source_hash = boot_id_hash();
+    hdr.ctl_hash = hash_mixer_ctls(ar);
+    hdr.num_settings = num_settings;
+    hdr.num_init = num_settings;
+    hdr.strings_offset = sizeof(hdr) + (uint64_t)num_settings * sizeof(*settings);
+    hdr.values_offset = cache_align(hdr.strings_offset);
+    hdr.file_size = hdr.values_offset + values_size;
+
+    buf = calloc(1, hdr.file_size);
+    if (!buf) {
+        ALOGE("%s: unable to allocate snapshot", __func__);
+        free(ctls);
+        return -1;
     }
+    settings = (void *)(buf + sizeof(hdr));
+    values_size = hdr.values_offset;
+
+    for (i = 0; i < num_settings; i++) {
+        struct mixer_state *ms = &ar->mixer_state[ctls[i]];
+
+        pthread_mutex_lock(ctl_lock(ar, ctls[i]));
+        cache_add_setting(&settings[i], buf, &values_size, ctls[i], ms->type, 0,
+                          ms->num_values, ms->old_value.ptr);
+        pthread_mutex_unlock(ctl_lock(ar, ctls[i]));
+    }
+    free(ctls);
+
+    hdr.data_hash = hash_bytes(HASH_INIT, buf + sizeof(hdr), hdr.file_size - sizeof(hdr));
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    ret = write_file(snapshot_path, buf, hdr.file_size);
+    free(buf);
+    return ret;
 }
 
-/* Apply an audio route path by name */
-int audio_route_apply_path(struct audio_route *ar, const char *name)
+static int parse_mixer_xml(struct audio_route *ar, const char *xml, size_t xml_size,
+                           const char *xml_path, bool reload)
 {
-    struct mixer_path *path;
+    struct config_parse_state state;
+    XML_Parser parser;
+    size_t offset = 0;
+    size_t len;
+    int ret = -1;
 
-    if (!ar) {
-        ALOGE("invalid audio_route");
+    parser = XML_ParserCreate(NULL);
+    if (!parser) {
+        ALOGE("Failed to create XML parser");
         return -1;
     }
 
-    path = path_get_by_name(ar, name);
-    if (!path) {
-        ALOGE("unable to find path '%s'", name);
-        return -1;
-    }
+    memset(&state, 0, sizeof(state));
+    state.ar = ar;
+    state.reload = reload;
+    XML_SetUserData(parser, &state);
+    XML_SetElementHandler(parser, start_tag, end_tag);
 
-    path_apply(ar, path);
+    /* expat tokenizes straight from the mapping, the chunks only bound what
+       it copies for a token split across two of them */
+    madvise((void *)xml, xml_size, MADV_SEQUENTIAL);
+    do {
+        len = xml_size - offset < XML_CHUNK_SIZE ? xml_size - offset : XML_CHUNK_SIZE;
+        if (XML_Parse(parser, xml + offset, len, offset + len == xml_size) ==
+                XML_STATUS_ERROR) {
+            ALOGE("Error in mixer xml (%s)", xml_path);
+            goto done;
+        }
+        offset += len;
+    } while (offset < xml_size);
+    ret = 0;
 
-    return 0;
+done:
+    free(state.values);
+    XML_ParserFree(parser);
+    return ret;
 }
 
-/* Reset an audio route path by name */
-int audio_route_reset_path(struct audio_route *ar, const char *name)
+/* shared route databases */
+
+static pthread_mutex_t db_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct route_db *db_registry;
+
+static struct route_db *db_create(uint64_t xml_hash, uint64_t ctl_hash, unsigned int num_ctls)
 {
-    struct mixer_path *path;
+    struct route_db *db = calloc(1, sizeof(struct route_db));
 
-    if (!ar) {
-        ALOGE("invalid audio_route");
-        return -1;
-    }
+    if (!db)
+        return NULL;
+    db->xml_hash = xml_hash;
+    db->ctl_hash = ctl_hash;
+    db->num_ctls = num_ctls;
+    db->refcount = 1;
+    return db;
+}
 
-    path = path_get_by_name(ar, name);
-    if (!path) {
-        ALOGE("unable to find path '%s'", name);
-        return -1;
-    }
+static struct route_db *db_find(uint64_t xml_hash, uint64_t ctl_hash, unsigned int num_ctls)
+{
+    struct route_db *db;
 
-    path_reset(ar, path);
+    for (db = db_registry; db; db = db->next)
+        if (db->xml_hash == xml_hash && db->ctl_hash == ctl_hash && db->num_ctls == num_ctls)
+            return db;
 
-    return 0;
+    return NULL;
+}
+
+/* take a reference to a published database, NULL if there is none */
+static struct route_db *db_get(uint64_t xml_hash, uint64_t ctl_hash, unsigned int num_ctls)
+{
+    struct route_db *db;
+
+    pthread_mutex_lock(&db_registry_lock);
+    db = db_find(xml_hash, ctl_hash, num_ctls);
+    if (db)
+        db->refcount++;
+    pthread_mutex_unlock(&db_registry_lock);
+
+    return db;
 }
 
 /*
- * Operates on the specified path .. controls will be updated in the
- * order listed in the XML file
+ * Publish a newly built database. If another thread published the same one
+ * meanwhile, the new one is freed and a reference to the other returned.
  */
-static int audio_route_update_path(struct audio_route *ar, const char *name, int direction)
+static struct route_db *db_publish(struct route_db *db)
 {
-    struct mixer_path *path;
-    unsigned int j;
-    bool reverse = direction != DIRECTION_FORWARD;
-    bool force_reset = direction == DIRECTION_REVERSE_RESET;
-
-    if (!ar) {
-        ALOGE("invalid audio_route");
-        return -1;
-    }
+    struct route_db *found;
 
-    path = path_get_by_name(ar, name);
-    if (!path) {
-        ALOGE("unable to find path '%s'", name);
-        return -1;
+    pthread_mutex_lock(&db_registry_lock);
+    found = db_find(db->xml_hash, db->ctl_hash, db->num_ctls);
+    if (found) {
+        found->refcount++;
+    } else {
+        db->next = db_registry;
+        db_registry = db;
     }
+    pthread_mutex_unlock(&db_registry_lock);
 
-    for (size_t i = 0; i < path->length; ++i) {
-        unsigned int ctl_index;
-        enum mixer_ctl_type type;
-
-        ctl_index = path->setting[reverse ? path->length - 1 - i : i].ctl_index;
+    if (found)
+        db_free(db);
+    return found ? found : db;
+}
 
-        struct mixer_state * ms = &ar->mixer_state[ctl_index];
+static void db_put(struct route_db *db)
+{
+    struct route_db **prev;
 
-        type = mixer_ctl_get_type(ms->ctl);
-        if (!is_supported_ctl_type(type)) {
-            continue;
+    pthread_mutex_lock(&db_registry_lock);
+    if (--db->refcount) {
+        pthread_mutex_unlock(&db_registry_lock);
+        return;
+    }
+    for (prev = &db_registry; *prev; prev = &(*prev)->next) {
+        if (*prev == db) {
+            *prev = db->next;
+            break;
         }
+    }
+    pthread_mutex_unlock(&db_registry_lock);
 
-        if (reverse && ms->active_count > 0) {
-            if (force_reset)
-                ms->active_count = 0;
-            else
-                ms->active_count--;
-        } else if (!reverse) {
-            ms->active_count++;
-        }
+    db_free(db);
+}
 
-       size_t value_sz = sizeof_ctl_type(type);
-        /* if any value has changed, update the mixer */
-        for (j = 0; j < ms->num_values; j++) {
-            if (type == MIXER_CTL_TYPE_BYTE) {
-                if (ms->old_value.bytes[j] != ms->new_value.bytes[j]) {
-                    if (reverse && ms->active_count > 0) {
-                        ALOGD("%s: skip to reset mixer control '%s' in path '%s' "
-                            "because it is still needed by other paths", __func__,
-                            mixer_ctl_get_name(ms->ctl), name);
-                        memcpy(ms->new_value.bytes, ms->old_value.bytes,
-                            ms->num_values * value_sz);
-                        break;
-                    }
-                    mixer_ctl_set_array(ms->ctl, ms->new_value.bytes, ms->num_values);
-                    memcpy(ms->old_value.bytes, ms->new_value.bytes, ms->num_values * value_sz);
-                    break;
-                }
-            } else if (type == MIXER_CTL_TYPE_ENUM) {
-                if (ms->old_value.enumerated[j] != ms->new_value.enumerated[j]) {
-                    if (reverse && ms->active_count > 0) {
-                        ALOGD("%s: skip to reset mixer control '%s' in path '%s' "
-                            "because it is still needed by other paths", __func__,
-                            mixer_ctl_get_name(ms->ctl), name);
-                        memcpy(ms->new_value.enumerated, ms->old_value.enumerated,
-                            ms->num_values * value_sz);
-                        break;
-                    }
-                    mixer_ctl_set_value(ms->ctl, 0, ms->new_value.enumerated[0]);
-                    memcpy(ms->old_value.enumerated, ms->new_value.enumerated,
-                            ms->num_values * value_sz);
-                    break;
-                }
-            } else if (ms->old_value.integer[j] != ms->new_value.integer[j]) {
-                if (reverse && ms->active_count > 0) {
-                    ALOGD("%s: skip to reset mixer control '%s' in path '%s' "
-                        "because it is still needed by other paths", __func__,
-                        mixer_ctl_get_name(ms->ctl), name);
-                    memcpy(ms->new_value.integer, ms->old_value.integer,
-                        ms->num_values * value_sz);
-                    break;
-                }
-                mixer_ctl_set_array(ms->ctl, ms->new_value.integer, ms->num_values);
-                memcpy(ms->old_value.integer, ms->new_value.integer, ms->num_values * value_sz);
-                break;
-            }
-        }
+/* free states and those of the databases it replaced */
+static void free_states(struct path_states *states)
+{
+    while (states) {
+        struct path_states *prev = states->prev;
+
+        db_put(states->db);
+        free(states->stats);
+        free(states);
+        states = prev;
     }
-    return 0;
 }
 
-int audio_route_apply_and_update_path(struct audio_route *ar, const char *name)
+static int init_value_cmp(const void *a, const void *b)
 {
-    if (audio_route_apply_path(ar, name) < 0) {
-        return -1;
-    }
-    return audio_route_update_path(ar, name, DIRECTION_FORWARD);
+    const struct init_value *x = a;
+    const struct init_value *y = b;
+
+    if (x->ctl_index != y->ctl_index)
+        return x->ctl_index < y->ctl_index ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
 }
 
-int audio_route_reset_and_update_path(struct audio_route *ar, const char *name)
+/*
+ * Save the values the top level <ctl> tags set, one setting per control
+ * or per run of consecutive ids. Values the tags leave alone were read
+ * from this mixer and are not saved.
+ */
+static int db_save_init(struct audio_route *ar)
 {
-    if (audio_route_reset_path(ar, name) < 0) {
+    struct path_builder *builder = &ar->builder;
+    struct route_db *db = ar->db;
+    const struct init_value *init = builder->init;
+    unsigned int i, j;
+
+    if (!builder->num_init)
+        return 0;
+
+    qsort(builder->init, builder->num_init, sizeof(*init), init_value_cmp);
+    db->init = arena_alloc(&db->path_arena, builder->num_init * sizeof(struct mixer_setting),
+                           sizeof(void *));
+    if (!db->init)
         return -1;
+
+    for (i = 0; i < builder->num_init; i = j) {
+        const struct mixer_state *ms = &ar->mixer_state[init[i].ctl_index];
+        struct mixer_setting *setting = &db->init[db->num_init];
+
+        /* a tag setting all values sorts first and covers the others */
+        j = i + 1;
+        if (init[i].id < 0) {
+            while (j < builder->num_init && init[j].ctl_index == init[i].ctl_index)
+                j++;
+            setting->index = 0;
+            setting->num_values = ms->num_values;
+        } else {
+            while (j < builder->num_init && init[j].ctl_index == init[i].ctl_index &&
+                   init[j].id <= init[j - 1].id + 1)
+                j++;
+            setting->index = init[i].id;
+            setting->num_values = init[j - 1].id - init[i].id + 1;
+        }
+        setting->ctl_index = init[i].ctl_index;
+        setting->type = ms->type;
+        setting->value.ptr = arena_alloc(&db->path_arena, setting->num_values * ms->value_size,
+                                         ms->value_size);
+        if (!setting->value.ptr)
+            return -1;
+        memcpy(setting->value.ptr, (char *)ms->new_value.ptr + setting->index * ms->value_size,
+               setting->num_values * ms->value_size);
+        db->num_init++;
     }
-    return audio_route_update_path(ar, name, DIRECTION_REVERSE);
+
+    return 0;
 }
 
-int audio_route_force_reset_and_update_path(struct audio_route *ar, const char *name)
+static void db_apply_init(struct audio_route *ar)
 {
-    if (audio_route_reset_path(ar, name) < 0) {
-        return -1;
-    }
+    struct route_db *db = ar->db;
+    unsigned int i;
 
-    return audio_route_update_path(ar, name, DIRECTION_REVERSE_RESET);
+    /* only the values the XML set, the others keep what this mixer reads */
+    for (i = 0; i < db->num_init; i++) {
+        const struct mixer_setting *setting = &db->init[i];
+        struct mixer_state *ms = &ar->mixer_state[setting->ctl_index];
+
+        load_ctl(ar, setting->ctl_index);
+        memcpy((char *)ms->new_value.ptr + setting->index * ms->value_size,
+               setting->value.ptr, setting->num_values * ms->value_size);
+        mark_ctl_dirty(ar, setting->ctl_index);
+    }
 }
 
-struct audio_route *audio_route_init(unsigned int card, const char *xml_path)
+static struct audio_route *route_init(unsigned int card, const char *xml_path,
+                                      const char *cache_path, const char *snapshot_path,
+                                      const struct audio_route_mixer_ops *ops)
 {
-    struct config_parse_state state;
-    XML_Parser parser;
-    FILE *file;
-    int bytes_read;
-    void *buf;
+    const char *xml;
+    size_t xml_size;
     struct audio_route *ar;
+    uint64_t xml_hash = 0;
+    uint64_t ctl_hash = 0;
 
     ar = calloc(1, sizeof(struct audio_route));
     if (!ar)
         goto err_calloc;
+    init_locks(ar);
+    ar->ops = ops;
 
-    ar->mixer = mixer_open(card);
+    ar->mixer = ar->ops->open(card);
     if (!ar->mixer) {
         ALOGE("Unable to open the mixer, aborting.");
         goto err_mixer_open;
     }
 
-    ar->mixer_path = NULL;
-    ar->mixer_path_size = 0;
-    ar->num_mixer_paths = 0;
-
-    /* allocate space for and read current mixer settings */
+    /* allocate space for the mixer settings, read when first used */
     if (alloc_mixer_state(ar) < 0)
         goto err_mixer_state;
 
+    ctl_hash = hash_mixer_ctls(ar);
+    if (snapshot_path)
+        snapshot_load(ar, snapshot_path, ctl_hash);
+
     /* use the default XML path if none is provided */
     if (xml_path == NULL)
         xml_path = MIXER_XML_PATH;
 
-    file = fopen(xml_path, "r");
-
-    if (!file) {
+    xml = map_file(xml_path, 0, &xml_size);
+    if (!xml) {
         ALOGE("Failed to open %s: %s", xml_path, strerror(errno));
-        goto err_fopen;
-    }
-
-    parser = XML_ParserCreate(NULL);
-    if (!parser) {
-        ALOGE("Failed to create XML parser");
-        goto err_parser_create;
+        goto err_map;
     }
 
-    memset(&state, 0, sizeof(state));
-    state.ar = ar;
-    XML_SetUserData(parser, &state);
-    XML_SetElementHandler(parser, start_tag, end_tag);
+    /* reuse the paths of another audio route for the same XML and controls */
+    xml_hash = hash_bytes(HASH_INIT, xml, xml_size);
+    ar->db = db_get(xml_hash, ctl_hash, ar->num_mixer_ctls);
+    if (ar->db) {
+        db_apply_init(ar);
+    } else {
+        ar->db = db_create(xml_hash, ctl_hash, ar->num_mixer_ctls);
+        if (!ar->db)
+            goto err_db;
+        ar->builder.db = ar->db;
 
-    for (;;) {
-        buf = XML_GetBuffer(parser, BUF_SIZE);
-        if (buf == NULL)
-            goto err_parse;
-
-        bytes_read = fread(buf, 1, BUF_SIZE, file);
-        if (bytes_read < 0)
-            goto err_parse;
-
-        if (XML_ParseBuffer(parser, bytes_read,
-                            bytes_read == 0) == XML_STATUS_ERROR) {
-            ALOGE("Error in mixer xml (%s)", MIXER_XML_PATH);
-            goto err_parse;
+        if (cache_path && cache_load(ar, cache_path, xml_hash, ctl_hash) == 0) {
+            db_apply_init(ar);
+        } else {
+            if (parse_mixer_xml(ar, xml, xml_size, xml_path, false) < 0 || db_save_init(ar) < 0)
+                goto err_parse;
+            if (cache_path)
+                cache_store(ar, cache_path, xml_hash, ctl_hash);
         }
+        builder_free(&ar->builder);
+        ar->db = db_publish(ar->db);
+    }
 
-        if (bytes_read == 0)
-            break;
+    ar->states = states_create(ar->db);
+    if (!ar->states) {
+        db_put(ar->db);
+        goto err_db;
     }
 
     /* apply the initial mixer values, and save them so we can reset the
@@ -1049,30 +4555,244 @@ struct audio_route *audio_route_init(unsigned int card, const char *xml_path)
     audio_route_update_mixer(ar);
     save_mixer_state(ar);
 
-    XML_ParserFree(parser);
-    fclose(file);
+    munmap((void *)xml, xml_size);
     return ar;
 
 err_parse:
-    path_free(ar);
-    XML_ParserFree(parser);
-err_parser_create:
-    fclose(file);
-err_fopen:
+    builder_free(&ar->builder);
+    db_free(ar->db);
+err_db:
+    munmap((void *)xml, xml_size);
+err_map:
     free_mixer_state(ar);
 err_mixer_state:
-    mixer_close(ar->mixer);
+    ar->ops->close(ar->mixer);
 err_mixer_open:
+    destroy_locks(ar);
     free(ar);
     ar = NULL;
 err_calloc:
     return NULL;
 }
 
+struct audio_route *audio_route_init_snapshot(unsigned int card, const char *xml_path,
+                                              const char *cache_path,
+                                              const char *snapshot_path)
+{
+    return route_init(card, xml_path, cache_path, snapshot_path, &tinyalsa_ops);
+}
+
+struct audio_route *audio_route_init_backend(unsigned int card, const char *xml_path,
+                                             const struct audio_route_mixer_ops *ops)
+{
+    if (!ops) {
+        ALOGE("%s: no mixer backend", __func__);
+        return NULL;
+    }
+
+    return route_init(card, xml_path, NULL, NULL, ops);
+}
+
+struct audio_route *audio_route_init_backend_cached(unsigned int card, const char *xml_path,
+                                                    const char *cache_path,
+                                                    const struct audio_route_mixer_ops *ops)
+{
+    if (!ops) {
+        ALOGE("%s: no mixer backend", __func__);
+        return NULL;
+    }
+
+    return route_init(card, xml_path, cache_path, NULL, ops);
+}
+
+struct audio_route *audio_route_init_backend_snapshot(unsigned int card, const char *xml_path,
+                                                      const char *cache_path,
+                                                      const char *snapshot_path,
+                                                      const struct audio_route_mixer_ops *ops)
+{
+    if (!ops) {
+        ALOGE("%s: no mixer backend", __func__);
+        return NULL;
+    }
+
+    return route_init(card, xml_path, cache_path, snapshot_path, ops);
+}
+
+struct audio_route *audio_route_init_cached(unsigned int card, const char *xml_path,
+                                            const char *cache_path)
+{
+    return route_init(card, xml_path, cache_path, NULL, &tinyalsa_ops);
+}
+
+struct audio_route *audio_route_init(unsigned int card, const char *xml_path)
+{
+    return route_init(card, xml_path, NULL, NULL, &tinyalsa_ops);
+}
+
+static bool path_equal(const struct mixer_path *a, const struct mixer_path *b)
+{
+    unsigned int i;
+
+    if (a->length != b->length)
+        return false;
+
+    for (i = 0; i < a->length; i++) {
+        if (a->op[i].ctl_index != b->op[i].ctl_index || a->op[i].size != b->op[i].size ||
+            memcmp(a->values + a->op[i].offset, b->values + b->op[i].offset, a->op[i].size))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Bring the mixer from the applied paths of the replaced database to those
+ * of the new one: a changed path is switched to its new version, a removed
+ * one is reset. Returns the number of paths updated.
+ */
+static int reload_active_paths(struct audio_route *ar, struct path_states *old,
+                               const unsigned int *active)
+{
+    struct route_db *db = __atomic_load_n(&ar->db, __ATOMIC_ACQUIRE);
+    unsigned int i, n;
+    int num_updated = 0;
+
+    audio_route_begin(ar);
+    for (i = 0; i < old->db->num_mixer_paths; i++) {
+        struct mixer_path *from = &old->db->mixer_path[i];
+        struct mixer_path *to = db_get_path(db, from->name);
+        unsigned int count = active[i];
+
+        if (!count || (to && path_equal(from, to)))
+            continue;
+
+        /* each apply holds a reference on the controls of the path */
+        for (n = 0; n < count; n++) {
+            if (to) {
+                path_switch(ar, from, to);
+            } else {
+                path_reset(ar, from);
+                path_update(ar, from, DIRECTION_REVERSE);
+            }
+        }
+        ALOGI("%s path '%s'", to ? "Updated" : "Reset removed", from->name);
+        num_updated++;
+    }
+    audio_route_commit(ar);
+
+    return num_updated;
+}
+
+int audio_route_reload(struct audio_route *ar, const char *xml_path)
+{
+    struct path_states *old, *states = NULL;
+    struct audio_route_path_stats *old_stats;
+    unsigned int *active = NULL;
+    struct route_db *db;
+    const char *xml;
+    size_t xml_size;
+    unsigned int i;
+    int ret = -1;
+
+    if (!ar) {
+        ALOGE("%s: invalid audio_route", __func__);
+        return -1;
+    }
+
+    if (xml_path == NULL)
+        xml_path = MIXER_XML_PATH;
+
+    xml = map_file(xml_path, 0, &xml_size);
+    if (!xml) {
+        ALOGE("Failed to open %s: %s", xml_path, strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&ar->reload_lock);
+    old = ar->states;
+
+    /* the new database is private to this audio route: it lacks the initial
+       settings that other audio routes sharing the XML would need */
+    db = db_create(hash_bytes(HASH_INIT, xml, xml_size), old->db->ctl_hash, ar->num_mixer_ctls);
+    if (!db)
+        goto done;
+    ar->builder.db = db;
+    if (parse_mixer_xml(ar, xml, xml_size, xml_path, true) < 0) {
+        builder_free(&ar->builder);
+        db_free(db);
+        goto done;
+    }
+    builder_free(&ar->builder);
+
+    states = states_create(db);
+    active = malloc(old->db->num_mixer_paths * sizeof(unsigned int));
+    if (!states || (old->db->num_mixer_paths && !active)) {
+        free(states);
+        db_free(db);
+        goto done;
+    }
+
+    /* paths keep their applied count and statistics by name; applies and
+       resets wait until the swap, then count on the new paths */
+    old_stats = __atomic_load_n(&old->stats, __ATOMIC_ACQUIRE);
+    if (old_stats)
+        alloc_path_stats(states);
+    pthread_rwlock_wrlock(&ar->states_lock);
+    for (i = 0; i < old->db->num_mixer_paths; i++) {
+        struct mixer_path *path = db_get_path(db, old->db->mixer_path[i].name);
+
+        active[i] = __atomic_load_n(&old->active[i], __ATOMIC_RELAXED);
+        if (!path)
+            continue;
+        states->active[path - db->mixer_path] = active[i];
+        if (old_stats && states->stats)
+            states->stats[path - db->mixer_path] = old_stats[i];
+    }
+
+    /* calls from other threads use either database until the swap */
+    states->prev = old;
+    __atomic_store_n(&ar->states, states, __ATOMIC_RELEASE);
+    __atomic_store_n(&ar->db, db, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&ar->states_lock);
+
+    ret = reload_active_paths(ar, old, active);
+    ALOGI("Reloaded %s: %u paths, %d applied paths updated", xml_path,
+          db->num_mixer_paths, ret);
+
+done:
+    pthread_mutex_unlock(&ar->reload_lock);
+    free(active);
+    munmap((void *)xml, xml_size);
+    if (ret < 0)
+        ALOGE("Failed to reload %s", xml_path);
+    return ret;
+}
+
 void audio_route_free(struct audio_route *ar)
 {
+    /* the worker cannot join itself, nor free the route it still runs on */
+    if (on_worker(ar)) {
+        ALOGE("%s: called from the worker thread, not freeing", __func__);
+        return;
+    }
+
+    /* the worker would wait for the caller's transaction to be committed */
+    if (in_transaction(ar)) {
+        ALOGW("%s: discarding %u uncommitted control writes", __func__, ar->num_pending);
+        transaction_abort(ar);
+    }
+
+    stop_worker(ar);
+
+    /* a transaction of another thread must not outlive its locks */
+    pthread_mutex_lock(&ar->transaction_lock);
+    pthread_mutex_unlock(&ar->transaction_lock);
+
+    free_ref_debug(ar->ref_debug, ar->num_mixer_ctls);
     free_mixer_state(ar);
-    mixer_close(ar->mixer);
-    path_free(ar);
+    ar->ops->close(ar->mixer);
+    free_states(ar->states);
+    free_stats(ar->stats);
+    destroy_locks(ar);
     free(ar);
 }
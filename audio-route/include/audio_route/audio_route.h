@@ -17,14 +17,113 @@
 #ifndef AUDIO_ROUTE_H
 #define AUDIO_ROUTE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
-/* Initialize and free the audio routes */
+/*
+ * Initialize and free the audio routes. After init, the path and update
+ * calls may be made from several threads at once, e.g. to change playback
+ * and capture routes in parallel; paths sharing a control are serialized on
+ * that control only.
+ *
+ * The parsed paths are shared: another init in the same process for the
+ * same XML contents and the same card control list reuses them instead of
+ * parsing again, and only the control values are kept per audio route.
+ * A top level <ctl> with an id sets only that value, the others keep what
+ * the new audio route reads from the card.
+ */
 struct audio_route *audio_route_init(unsigned int card, const char *xml_path);
 void audio_route_free(struct audio_route *ar);
 
+/*
+ * Same as audio_route_init(), but keeps the parsed paths in cache_path. The
+ * cache is used when it matches both the XML contents and the card's control
+ * list, otherwise the XML is parsed and the cache rewritten. The setting
+ * values are used from the mapped cache, so processes loading the same
+ * cache share their memory.
+ */
+struct audio_route *audio_route_init_cached(unsigned int card, const char *xml_path,
+                                            const char *cache_path);
+
+/*
+ * Reload the paths from xml_path, NULL for the default, e.g. after tuning
+ * changes, without reopening the mixer or reading the controls again. The
+ * file is parsed while other threads keep routing, then replaces the paths
+ * at once. Applied paths whose settings changed are switched to their new
+ * version and applied paths missing from the file are reset, in one
+ * transaction; all other control values and references are kept. Initial
+ * settings at the top level of the file are not applied again. Handles
+ * from audio_route_get_path() stay valid but keep the old version of their
+ * path, so look them up again after a reload. Returns the number of paths
+ * updated, or -1 on error with the old paths still in place.
+ */
+int audio_route_reload(struct audio_route *ar, const char *xml_path);
+
+/*
+ * Mixer backend. audio_route_init() and the other init calls use tinyalsa;
+ * audio_route_init_backend() takes the mixer calls from ops instead, e.g. to
+ * run against an in-memory card in tests and benchmarks. The calls have the
+ * semantics of the tinyalsa functions of the same name, and the mixer and
+ * control types are opaque to audio_route. ctl_get_type() returns a tinyalsa
+ * enum mixer_ctl_type value.
+ */
+struct mixer;
+struct mixer_ctl;
+
+struct audio_route_mixer_ops {
+    struct mixer *(*open)(unsigned int card);
+    void (*close)(struct mixer *mixer);
+    unsigned int (*get_num_ctls)(struct mixer *mixer);
+    struct mixer_ctl *(*get_ctl)(struct mixer *mixer, unsigned int id);
+    const char *(*ctl_get_name)(struct mixer_ctl *ctl);
+    int (*ctl_get_type)(struct mixer_ctl *ctl);
+    unsigned int (*ctl_get_num_values)(struct mixer_ctl *ctl);
+    unsigned int (*ctl_get_num_enums)(struct mixer_ctl *ctl);
+    const char *(*ctl_get_enum_string)(struct mixer_ctl *ctl, unsigned int enum_id);
+    int (*ctl_get_value)(struct mixer_ctl *ctl, unsigned int id);
+    int (*ctl_get_array)(struct mixer_ctl *ctl, void *array, size_t count);
+    int (*ctl_set_value)(struct mixer_ctl *ctl, unsigned int id, int value);
+    int (*ctl_set_array)(struct mixer_ctl *ctl, const void *array, size_t count);
+    /*
+     * Optional: write count values starting at value offset, leaving the
+     * others untouched, e.g. through a TLV write. Returns 0 on success; on
+     * error audio_route falls back to ctl_set_array().
+     */
+    int (*ctl_set_array_range)(struct mixer_ctl *ctl, const void *array, size_t offset,
+                               size_t count);
+};
+
+struct audio_route *audio_route_init_backend(unsigned int card, const char *xml_path,
+                                             const struct audio_route_mixer_ops *ops);
+/* audio_route_init_cached() with the mixer calls from ops */
+struct audio_route *audio_route_init_backend_cached(unsigned int card, const char *xml_path,
+                                                    const char *cache_path,
+                                                    const struct audio_route_mixer_ops *ops);
+
+/*
+ * Control values are read from the mixer when a path or initial setting
+ * first uses them, once: a control whose read fails starts from zeros.
+ * audio_route_save_snapshot() stores the values known so
+ * far, and audio_route_init_snapshot() seeds them from that file instead of
+ * reading the mixer, e.g. when the audio server restarts. The snapshot is
+ * only used during the boot it was saved in and for the same control list;
+ * it must not be used if other clients may have changed the controls since
+ * it was saved. cache_path and snapshot_path may be NULL.
+ */
+struct audio_route *audio_route_init_snapshot(unsigned int card, const char *xml_path,
+                                              const char *cache_path,
+                                              const char *snapshot_path);
+/* audio_route_init_snapshot() with the mixer calls from ops */
+struct audio_route *audio_route_init_backend_snapshot(unsigned int card, const char *xml_path,
+                                                      const char *cache_path,
+                                                      const char *snapshot_path,
+                                                      const struct audio_route_mixer_ops *ops);
+int audio_route_save_snapshot(struct audio_route *ar, const char *snapshot_path);
+
 /* Apply an audio route path by name */
 int audio_route_apply_path(struct audio_route *ar, const char *name);
 
@@ -40,7 +139,234 @@ int audio_route_reset_and_update_path(struct audio_route *ar, const char *name);
 /* Reset and update mixer with audio route path by name forcely */
 int audio_route_force_reset_and_update_path(struct audio_route *ar, const char *name);
 
-/* Reset the audio routes back to the initial state */
+/*
+ * Switch from one path to another and update the mixer. The result is the
+ * same as audio_route_reset_and_update_path(from) followed by
+ * audio_route_apply_and_update_path(to), but controls set by both paths are
+ * not written back to their reset value in between: each is written at most
+ * once, and only if its final value differs from the current one.
+ */
+int audio_route_switch_path(struct audio_route *ar, const char *from, const char *to);
+
+/*
+ * Apply or reset several paths and update the mixer in one pass, e.g. all the
+ * paths of a device combination. The result is the same as applying the
+ * paths in order with audio_route_apply_and_update_path(), or resetting them
+ * with audio_route_reset_and_update_path() in reverse order, except that a
+ * control set by more than one path gets the value of the last one and is
+ * written at most once. Nothing is changed if a name is unknown.
+ */
+int audio_route_apply_and_update_paths(struct audio_route *ar, const char *const names[],
+                                       unsigned int num_paths);
+int audio_route_reset_and_update_paths(struct audio_route *ar, const char *const names[],
+                                       unsigned int num_paths);
+
+/*
+ * Look up an audio route path by name. The returned handle stays valid until
+ * audio_route_free() and lets callers apply or reset the path without a name
+ * lookup on every call.
+ */
+struct mixer_path *audio_route_get_path(struct audio_route *ar, const char *name);
+
+/* Path handle variants of the calls above */
+int audio_route_apply_path_by_handle(struct audio_route *ar, struct mixer_path *path);
+int audio_route_apply_and_update_path_by_handle(struct audio_route *ar,
+                                                struct mixer_path *path);
+int audio_route_reset_path_by_handle(struct audio_route *ar, struct mixer_path *path);
+int audio_route_reset_and_update_path_by_handle(struct audio_route *ar,
+                                                struct mixer_path *path);
+int audio_route_force_reset_and_update_path_by_handle(struct audio_route *ar,
+                                                      struct mixer_path *path);
+int audio_route_switch_path_by_handle(struct audio_route *ar, struct mixer_path *from,
+                                      struct mixer_path *to);
+int audio_route_apply_and_update_paths_by_handle(struct audio_route *ar,
+                                                 struct mixer_path *const paths[],
+                                                 unsigned int num_paths);
+int audio_route_reset_and_update_paths_by_handle(struct audio_route *ar,
+                                                 struct mixer_path *const paths[],
+                                                 unsigned int num_paths);
+
+/*
+ * Resolve an enum string of a mixer control to its value, or -1 if the
+ * control is not an enum or has no such string. The names are fetched from
+ * the mixer once per control, so this is cheap enough to call at runtime.
+ */
+int audio_route_get_enum_value(struct audio_route *ar, const char *ctl_name,
+                               const char *string);
+
+/*
+ * How changed INT and BYTE array controls are written when the backend has
+ * ctl_set_array_range(). AUTO, the default, writes only the changed span of
+ * arrays of 256 bytes or more, and smaller arrays whole.
+ */
+enum audio_route_write_mode {
+    AUDIO_ROUTE_WRITE_AUTO,
+    AUDIO_ROUTE_WRITE_FULL,
+    AUDIO_ROUTE_WRITE_DELTA,
+};
+
+int audio_route_set_ctl_write_mode(struct audio_route *ar, const char *ctl_name,
+                                   enum audio_route_write_mode mode);
+
+/*
+ * Group mixer updates into one transaction. Between audio_route_begin() and
+ * audio_route_commit() the update calls only queue control writes; repeated
+ * writes to a control are coalesced and the commit issues at most one write
+ * per control, in the order the controls were first written, skipping
+ * controls that end up back at their committed value. Transactions nest,
+ * only the outermost commit writes. audio_route_commit() returns the number
+ * of controls written, or a negative value on error.
+ *
+ * A transaction belongs to the thread that began it: updates from other
+ * threads are written directly, and their audio_route_begin() waits until
+ * the open transaction is committed. audio_route_free() drops the queued
+ * writes of a transaction the caller has open, and waits for the commit of
+ * one opened by another thread.
+ */
+int audio_route_begin(struct audio_route *ar);
+int audio_route_commit(struct audio_route *ar);
+
+/*
+ * Asynchronous updates. audio_route_start_worker() starts a thread that runs
+ * submitted requests, so the caller does not block on control writes. A
+ * request is a list of path operations run in order as one transaction.
+ * Requests run one at a time in submission order, except that a request
+ * with an earlier deadline (CLOCK_MONOTONIC nanoseconds, 0 for none), e.g.
+ * a voice call route, may run ahead of queued requests it shares no control
+ * with. Requests sharing a control always run in submission order.
+ *
+ * audio_route_submit() returns the request id, or -1 on error. When the
+ * request has run, done is called on the worker thread with the id and the
+ * result, and the eventfd returned by audio_route_get_worker_fd() is
+ * incremented. audio_route_flush() waits for all submitted requests. It
+ * returns -EDEADLK without waiting when the calling thread has a transaction
+ * open, since the worker runs requests in transactions, or when called from
+ * done. audio_route_free() runs the queued requests and stops the worker; it
+ * must not be called from done, and does nothing there.
+ */
+enum audio_route_op_type {
+    AUDIO_ROUTE_OP_APPLY,       /* apply and update path */
+    AUDIO_ROUTE_OP_RESET,       /* reset and update path */
+    AUDIO_ROUTE_OP_FORCE_RESET, /* force reset and update path */
+    AUDIO_ROUTE_OP_SWITCH,      /* switch from one path to path */
+};
+
+struct audio_route_op {
+    enum audio_route_op_type type;
+    struct mixer_path *path;
+    struct mixer_path *from;
+};
+
+typedef void (*audio_route_done_t)(void *cookie, int id, int result);
+
+int audio_route_start_worker(struct audio_route *ar);
+int audio_route_get_worker_fd(struct audio_route *ar);
+int audio_route_submit(struct audio_route *ar, const struct audio_route_op *ops,
+                       unsigned int num_ops, uint64_t deadline,
+                       audio_route_done_t done, void *cookie);
+int audio_route_flush(struct audio_route *ar);
+
+/*
+ * Routing statistics, off until enabled. AUDIO_ROUTE_STATS_COUNT keeps the
+ * number and latency of path lookups, applies, resets and updates, per path
+ * and for every control write. AUDIO_ROUTE_STATS_TRACE writes path calls
+ * and control writes as begin/end events to the ftrace trace_marker, where
+ * systrace and Perfetto show them as slices. While disabled, a call only
+ * tests a pointer. Enabling with flags 0 stops both; the counts are kept
+ * until audio_route_reset_stats().
+ *
+ * Update latencies include the control writes, so the time spent finding
+ * changed controls is the update time less the control write time. The
+ * histograms count calls per power of two microseconds: bucket 0 holds
+ * calls under 1 us, bucket i those from 2^(i-1) us to under 2^i us, and
+ * the last bucket all longer calls.
+ */
+#define AUDIO_ROUTE_STATS_COUNT 0x1
+#define AUDIO_ROUTE_STATS_TRACE 0x2
+
+#define AUDIO_ROUTE_STATS_BUCKETS 20
+
+struct audio_route_latency {
+    unsigned long count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    unsigned long hist[AUDIO_ROUTE_STATS_BUCKETS];
+};
+
+struct audio_route_stats {
+    struct audio_route_latency lookup;      /* path name lookups */
+    struct audio_route_latency apply;       /* queueing the values of a path */
+    struct audio_route_latency reset;
+    struct audio_route_latency update;      /* path, switch and mixer updates */
+    struct audio_route_latency ctl_write;   /* single control writes */
+};
+
+struct audio_route_path_stats {
+    unsigned long applies;
+    unsigned long resets;
+    unsigned long updates;
+    uint64_t update_ns;
+    uint64_t max_update_ns;
+};
+
+struct audio_route_ctl_stats {
+    const char *name;
+    unsigned long writes;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+int audio_route_enable_stats(struct audio_route *ar, unsigned int flags);
+int audio_route_get_stats(struct audio_route *ar, struct audio_route_stats *stats);
+int audio_route_get_path_stats(struct audio_route *ar, const char *name,
+                               struct audio_route_path_stats *stats);
+/*
+ * Fill stats with up to n written controls, the one with the longest single
+ * write first, and return how many were filled. The names stay valid until
+ * audio_route_free().
+ */
+int audio_route_get_slowest_ctls(struct audio_route *ar, struct audio_route_ctl_stats *stats,
+                                 unsigned int n);
+void audio_route_reset_stats(struct audio_route *ar);
+
+/*
+ * Path and control references. A path updated after being applied holds a
+ * reference on each of its controls, and resetting it only writes a control
+ * back when no other path holds one. audio_route_get_active_paths() fills
+ * paths with up to n paths applied more times than reset, with that count.
+ * audio_route_get_ctl_refs() stores the number of references on a control
+ * in refs and fills holders with up to n paths holding them. Both return
+ * how many entries were filled, or -1 on an invalid parameter; the names
+ * stay valid until audio_route_free(). audio_route_dump_refs() writes the
+ * active paths and every referenced control with its holders to fd.
+ *
+ * Holders are the active paths setting the control, unless reference
+ * debugging is enabled: then each reference records the path that took it.
+ * A reset dropping a reference held by another path, or a forced reset
+ * dropping those of other paths, is logged with both paths and counted in
+ * audio_route_get_ref_errors(). References taken before debugging was
+ * enabled are assigned to the active paths, or to "(unknown)".
+ */
+struct audio_route_path_refs {
+    const char *name;
+    unsigned int count;
+};
+
+int audio_route_get_active_paths(struct audio_route *ar, struct audio_route_path_refs *paths,
+                                 unsigned int n);
+int audio_route_get_ctl_refs(struct audio_route *ar, const char *ctl_name,
+                             unsigned int *refs, struct audio_route_path_refs *holders,
+                             unsigned int n);
+void audio_route_dump_refs(struct audio_route *ar, int fd);
+int audio_route_enable_ref_debug(struct audio_route *ar, int enable);
+unsigned long audio_route_get_ref_errors(struct audio_route *ar);
+
+/*
+ * Reset the audio routes back to the initial state. This also drops every
+ * path and control reference, as if all paths had been force reset: paths
+ * applied before count as reset afterwards, and applying one again takes
+ * its controls afresh instead of stacking on references from before.
+ */
 void audio_route_reset(struct audio_route *ar);
 
 /* Update the mixer with any changed values */
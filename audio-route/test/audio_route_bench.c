@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <tinyalsa/asoundlib.h>
+#include <audio_route/audio_route.h>
+#include "fake_mixer.h"
+
+#define DEFAULT_ITERATIONS 1000
+#define CACHED_INIT_RUNS 10
+#define SWEEP_INIT_RUNS 5
+#define SWEEP_SETTINGS_PER_PATH 16
+
+struct bench_stat {
+    const char *name;
+    unsigned long count;
+    double total_us;
+    double min_us;
+    double max_us;
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void stat_add(struct bench_stat *stat, double us)
+{
+    if (stat->count == 0 || us < stat->min_us)
+        stat->min_us = us;
+    if (stat->count == 0 || us > stat->max_us)
+        stat->max_us = us;
+    stat->total_us += us;
+    stat->count++;
+}
+
+static void stat_print(struct bench_stat *stat)
+{
+    if (!stat->count)
+        return;
+    printf("%-24s runs %6lu  avg %10.2f us  min %10.2f us  max %10.2f us\n",
+           stat->name, stat->count, stat->total_us / stat->count,
+           stat->min_us, stat->max_us);
+}
+
+static unsigned int count_ctls(unsigned int card, bool fake)
+{
+    struct mixer *mixer;
+    unsigned int num_ctls = 0;
+
+    if (fake)
+        return fake_mixer_num_ctls(card);
+
+    mixer = mixer_open(card);
+    if (mixer) {
+        num_ctls = mixer_get_num_ctls(mixer);
+        mixer_close(mixer);
+    }
+    return num_ctls;
+}
+
+/* resident set size in KiB */
+static long rss_kb(void)
+{
+    long pages = 0;
+    long resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+
+    if (!file)
+        return 0;
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(file);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static struct audio_route *bench_init(unsigned int card, const char *xml, bool fake)
+{
+    if (fake)
+        return audio_route_init_backend(card, xml, fake_mixer_ops());
+    return audio_route_init(card, xml);
+}
+
+static void print_ioctls(const char *name, const struct fake_mixer_stats *stats,
+                         unsigned long runs)
+{
+    if (!runs)
+        return;
+    printf("%-24s %8.2f writes (%.2f partial) %8.2f reads %10.2f bytes written per call\n",
+           name, (double)stats->writes / runs, (double)stats->range_writes / runs,
+           (double)stats->reads / runs, (double)stats->bytes_written / runs);
+}
+
+/*
+ * Write a synthetic fake card and mixer_paths.xml with num_ctls controls,
+ * a quarter of them byte arrays, and one path per SWEEP_SETTINGS_PER_PATH
+ * controls, every path also setting a control of the next one.
+ */
+static int write_synthetic(const char *card_path, const char *xml_path, unsigned int num_ctls)
+{
+    FILE *card = fopen(card_path, "w");
+    FILE *xml = fopen(xml_path, "w");
+    unsigned int num_paths = num_ctls / SWEEP_SETTINGS_PER_PATH;
+    unsigned int i, j;
+
+    if (!card || !xml) {
+        if (card)
+            fclose(card);
+        if (xml)
+            fclose(xml);
+        return -1;
+    }
+
+    for (i = 0; i < num_ctls; i++) {
+        if (i % 4 == 3)
+            fprintf(card, "byte 64 Ctl %u\n", i);
+        else if (i % 4 == 2)
+            fprintf(card, "enum Ctl %u: Off On Auto\n", i);
+        else
+            fprintf(card, "int 2 Ctl %u\n", i);
+    }
+
+    fprintf(xml, "<mixer>\n");
+    for (i = 0; i < num_ctls; i++) {
+        if (i % 4 == 2)
+            fprintf(xml, "    <ctl name=\"Ctl %u\" value=\"Off\" />\n", i);
+        else
+            fprintf(xml, "    <ctl name=\"Ctl %u\" value=\"0\" />\n", i);
+    }
+    for (i = 0; i < num_paths; i++) {
+        fprintf(xml, "    <path name=\"path%u\">\n", i);
+        for (j = 0; j <= SWEEP_SETTINGS_PER_PATH; j++) {
+            unsigned int ctl = (i * SWEEP_SETTINGS_PER_PATH + j) % num_ctls;
+
+            if (ctl % 4 == 3)
+                fprintf(xml, "        <ctl name=\"Ctl %u\" value=\"0x%02x 0x10 0x20\" />\n",
+                        ctl, i & 0xff);
+            else if (ctl % 4 == 2)
+                fprintf(xml, "        <ctl name=\"Ctl %u\" value=\"On\" />\n", ctl);
+            else
+                fprintf(xml, "        <ctl name=\"Ctl %u\" value=\"%u\" />\n", ctl, i + 1);
+        }
+        fprintf(xml, "    </path>\n");
+    }
+    fprintf(xml, "</mixer>\n");
+
+    fclose(card);
+    return fclose(xml);
+}
+
+/* init time and memory over XML size, on synthetic fake cards */
+static int run_sweep(unsigned int card)
+{
+    static const unsigned int sizes[] = { 256, 1024, 4096, 16384 };
+    char card_path[] = "/tmp/audio_route_bench_card.txt";
+    char xml_path[] = "/tmp/audio_route_bench_paths.xml";
+    unsigned int i, run;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct bench_stat init = { .name = "audio_route_init" };
+        struct audio_route *ar;
+        struct stat st;
+        long rss = 0;
+        double start;
+
+        if (write_synthetic(card_path, xml_path, sizes[i]) < 0 ||
+            fake_mixer_load(card, card_path) < 0 || stat(xml_path, &st) < 0) {
+            printf("unable to create synthetic card of %u controls\n", sizes[i]);
+            return 1;
+        }
+
+        for (run = 0; run < SWEEP_INIT_RUNS; run++) {
+            long before = rss_kb();
+
+            start = now_us();
+            ar = bench_init(card, xml_path, true);
+            stat_add(&init, now_us() - start);
+            if (!ar) {
+                printf("audio_route_init failed for %s\n", xml_path);
+                return 1;
+            }
+            if (run == 0)
+                rss = rss_kb() - before;
+            audio_route_free(ar);
+        }
+
+        printf("%6u controls, %6u paths, %8lld bytes XML, %6ld KiB RSS\n", sizes[i],
+               sizes[i] / SWEEP_SETTINGS_PER_PATH, (long long)st.st_size, rss);
+        stat_print(&init);
+    }
+
+    fake_mixer_unload(card);
+    unlink(card_path);
+    unlink(xml_path);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s -x mixer_paths.xml -p path [-c card] [-n iterations] [-t] [-C cache]\n"
+           "          [-f fake_card] [-s to_path]\n", prog);
+    printf("       %s -S\n", prog);
+    printf("  applies and resets the path, timing audio_route_update_mixer()\n");
+    printf("  -t also times reset+apply transitions inside audio_route_begin/commit\n");
+    printf("  -C times audio_route_init_cached() without (cold) and with (warm) the cache\n");
+    printf("  -f runs against an in-memory card described by fake_card, see fake_mixer.h,\n");
+    printf("     and reports control reads and writes per call\n");
+    printf("  -s also times switching between path and to_path\n");
+    printf("  -S times init and memory over synthetic fake cards of growing size\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_stat init = { .name = "audio_route_init" };
+    struct bench_stat init_cold = { .name = "init_cached (cold)" };
+    struct bench_stat init_warm = { .name = "init_cached (warm)" };
+    struct bench_stat update_apply = { .name = "update_mixer (apply)" };
+    struct bench_stat update_reset = { .name = "update_mixer (reset)" };
+    struct bench_stat update_idle = { .name = "update_mixer (no-op)" };
+    struct bench_stat transition = { .name = "transaction transition" };
+    struct bench_stat apply = { .name = "apply_and_update" };
+    struct bench_stat reset = { .name = "reset_and_update" };
+    struct bench_stat switch_path = { .name = "switch_path" };
+    struct fake_mixer_stats apply_ioctls = { 0 };
+    struct fake_mixer_stats reset_ioctls = { 0 };
+    struct fake_mixer_stats switch_ioctls = { 0 };
+    struct fake_mixer_stats stats;
+    unsigned long transition_writes = 0;
+    bool transactions = false;
+    struct audio_route *ar;
+    const char *xml = NULL;
+    const char *path = NULL;
+    const char *cache = NULL;
+    const char *fake_card = NULL;
+    const char *to_path = NULL;
+    long rss = 0;
+    unsigned int card = 0;
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    unsigned long i;
+    double start;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:x:p:n:tC:f:s:Sh")) != -1) {
+        switch (opt) {
+        case 'c':
+            card = atoi(optarg);
+            break;
+        case 'x':
+            xml = optarg;
+            break;
+        case 'p':
+            path = optarg;
+            break;
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            transactions = true;
+            break;
+        case 'C':
+            cache = optarg;
+            break;
+        case 'f':
+            fake_card = optarg;
+            break;
+        case 's':
+            to_path = optarg;
+            break;
+        case 'S':
+            return run_sweep(card);
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!xml || !path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (fake_card && fake_mixer_load(card, fake_card) < 0) {
+        printf("unable to load fake card %s\n", fake_card);
+        return 1;
+    }
+
+    rss = rss_kb();
+    start = now_us();
+    ar = bench_init(card, xml, fake_card != NULL);
+    stat_add(&init, now_us() - start);
+    rss = rss_kb() - rss;
+    if (!ar) {
+        printf("audio_route_init failed for card %u, %s\n", card, xml);
+        return 1;
+    }
+
+    /* the cache is only used with tinyalsa */
+    for (i = 0; cache && !fake_card && i <= CACHED_INIT_RUNS; i++) {
+        struct audio_route *cached;
+
+        /* the first run parses the XML and writes the cache */
+        if (i == 0)
+            unlink(cache);
+        start = now_us();
+        cached = audio_route_init_cached(card, xml, cache);
+        stat_add(i == 0 ? &init_cold : &init_warm, now_us() - start);
+        if (!cached) {
+            printf("audio_route_init_cached failed for %s\n", cache);
+            break;
+        }
+        audio_route_free(cached);
+    }
+
+    for (i = 0; i < iterations; i++) {
+        if (audio_route_apply_path(ar, path) < 0) {
+            printf("unable to apply path %s\n", path);
+            break;
+        }
+        start = now_us();
+        audio_route_update_mixer(ar);
+        stat_add(&update_apply, now_us() - start);
+
+        start = now_us();
+        audio_route_update_mixer(ar);
+        stat_add(&update_idle, now_us() - start);
+
+        audio_route_reset_path(ar, path);
+        start = now_us();
+        audio_route_update_mixer(ar);
+        stat_add(&update_reset, now_us() - start);
+    }
+
+    for (i = 0; i < iterations; i++) {
+        fake_mixer_reset_stats(card);
+        start = now_us();
+        audio_route_apply_and_update_path(ar, path);
+        stat_add(&apply, now_us() - start);
+        fake_mixer_get_stats(card, &stats);
+        apply_ioctls.reads += stats.reads;
+        apply_ioctls.writes += stats.writes;
+        apply_ioctls.range_writes += stats.range_writes;
+        apply_ioctls.bytes_written += stats.bytes_written;
+
+        if (to_path) {
+            fake_mixer_reset_stats(card);
+            start = now_us();
+            audio_route_switch_path(ar, path, to_path);
+            stat_add(&switch_path, now_us() - start);
+            fake_mixer_get_stats(card, &stats);
+            switch_ioctls.reads += stats.reads;
+            switch_ioctls.writes += stats.writes;
+            switch_ioctls.range_writes += stats.range_writes;
+            switch_ioctls.bytes_written += stats.bytes_written;
+            audio_route_switch_path(ar, to_path, path);
+        }
+
+        fake_mixer_reset_stats(card);
+        start = now_us();
+        audio_route_reset_and_update_path(ar, path);
+        stat_add(&reset, now_us() - start);
+        fake_mixer_get_stats(card, &stats);
+        reset_ioctls.reads += stats.reads;
+        reset_ioctls.writes += stats.writes;
+        reset_ioctls.range_writes += stats.range_writes;
+        reset_ioctls.bytes_written += stats.bytes_written;
+    }
+
+    for (i = 0; transactions && i < iterations; i++) {
+        int written;
+
+        audio_route_apply_and_update_path(ar, path);
+        start = now_us();
+        audio_route_begin(ar);
+        audio_route_reset_and_update_path(ar, path);
+        audio_route_apply_and_update_path(ar, path);
+        written = audio_route_commit(ar);
+        stat_add(&transition, now_us() - start);
+        if (written > 0)
+            transition_writes += written;
+        audio_route_reset_and_update_path(ar, path);
+    }
+
+    printf("card %u: %u mixer controls, path '%s'\n", card, count_ctls(card, fake_card != NULL), path);
+    stat_print(&init);
+    printf("%-24s %ld KiB RSS\n", "", rss);
+    stat_print(&init_cold);
+    stat_print(&init_warm);
+    stat_print(&update_apply);
+    stat_print(&update_reset);
+    stat_print(&update_idle);
+    stat_print(&apply);
+    stat_print(&reset);
+    stat_print(&switch_path);
+    stat_print(&transition);
+    if (transition.count)
+        printf("%-24s %.2f control writes per transition\n", "",
+               (double)transition_writes / transition.count);
+    if (fake_card) {
+        print_ioctls("apply_and_update", &apply_ioctls, apply.count);
+        print_ioctls("reset_and_update", &reset_ioctls, reset.count);
+        print_ioctls("switch_path", &switch_ioctls, switch_path.count);
+    }
+
+    audio_route_free(ar);
+    fake_mixer_unload(card);
+    return 0;
+}
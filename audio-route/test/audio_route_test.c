@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+#include <errno.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <audio_route/audio_route.h>
+#include "fake_mixer.h"
+
+#define LINE_SIZE 1024
+#define TEST_CARD 0
+#define MAX_PATHS 16
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-d data_dir] [-n name] [-u]\n", prog);
+    printf("  runs <name>.script against the fake card <name>.card and the paths in\n");
+    printf("  <name>.xml, and compares the control writes with <name>.golden\n");
+    printf("  -d directory of the test data, default $srcdir/data\n");
+    printf("  -n test name, default routes\n");
+    printf("  -u rewrite the golden file instead of comparing\n");
+}
+
+/*
+ * Script commands, one per line:
+ *   apply|reset|apply_and_update|reset_and_update|force_reset_and_update <path>
+ *   switch <from> <to>
+ *   apply_paths|reset_paths <path> <path> ...
+ *   write_mode <auto|full|delta> <ctl>
+ *   reload <xml file in the data directory>
+ *   reinit [cached|shared|snapshot]
+ *   set <id> <value> <ctl>
+ *   read_error <on|off> <ctl>
+ *   refs <ctl>
+ *   update | begin | commit | reset_all | ref_debug | active_paths | ref_errors
+ *   snapshot
+ *   worker | submit <deadline> <apply|reset|force_reset> <path> | hold | release | flush
+ *   submit <deadline> switch <from> <to>
+ *
+ * refs, active_paths and ref_errors print the references to the log.
+ * reinit frees the audio route and inits it again, from a path cache kept
+ * for the run with cached, from the paths of the old audio route with
+ * shared, which is freed after the new one is up, or seeded from the file
+ * the last snapshot command saved with snapshot. set writes a control value
+ * straight to the card, as another client of the card would, and
+ * read_error makes the reads of a control fail.
+ *
+ * worker starts the request worker, and submit queues a request of one op.
+ * Each request logs "done <id>: <result>" when it has run. After hold, the
+ * next request to finish waits in its done callback until release, so the
+ * requests submitted meanwhile are queued together.
+ */
+static void print_refs(FILE *log, const char *what, const struct audio_route_path_refs *refs,
+                       int num_refs)
+{
+    int i;
+
+    fprintf(log, "%s", what);
+    for (i = 0; i < num_refs; i++)
+        fprintf(log, "%s%s %u", i ? ", " : " ", refs[i].name, refs[i].count);
+    fprintf(log, "\n");
+}
+
+/* files a script uses, the temporary ones stay empty until written */
+struct test_files {
+    const char *dir;
+    const char *xml;
+    char cache[32];
+    char snapshot[32];
+};
+
+/* requests submitted to the worker, their done callbacks run on it */
+static struct {
+    struct audio_route *ar;
+    FILE *log;
+    bool hold;
+    sem_t held;
+    sem_t release;
+} requests;
+
+static void request_done(void *cookie, int id, int result)
+{
+    (void)cookie;
+
+    fprintf(requests.log, "done %d: %d\n", id, result);
+    /* both would wait for the worker, which is running this callback */
+    if (audio_route_flush(requests.ar) != -EDEADLK)
+        fprintf(requests.log, "flush from done did not fail\n");
+    audio_route_free(requests.ar);
+
+    if (requests.hold) {
+        requests.hold = false;
+        sem_post(&requests.held);
+        sem_wait(&requests.release);
+    }
+}
+
+static int submit_request(struct audio_route *ar, const char *deadline, const char *type,
+                          const char *path, const char *to)
+{
+    struct audio_route_op op = { .path = audio_route_get_path(ar, path) };
+    bool hold = requests.hold;
+
+    if (strcmp(type, "apply") == 0) {
+        op.type = AUDIO_ROUTE_OP_APPLY;
+    } else if (strcmp(type, "reset") == 0) {
+        op.type = AUDIO_ROUTE_OP_RESET;
+    } else if (strcmp(type, "force_reset") == 0) {
+        op.type = AUDIO_ROUTE_OP_FORCE_RESET;
+    } else if (strcmp(type, "switch") == 0 && to) {
+        op.type = AUDIO_ROUTE_OP_SWITCH;
+        op.from = op.path;
+        op.path = audio_route_get_path(ar, to);
+    } else {
+        return -1;
+    }
+
+    if (audio_route_submit(ar, &op, 1, strtoull(deadline, NULL, 0), request_done, NULL) < 0)
+        return -1;
+    if (hold)
+        sem_wait(&requests.held);
+    return 0;
+}
+
+static int set_card_value(const char *name, unsigned int id, int value)
+{
+    const struct audio_route_mixer_ops *ops = fake_mixer_ops();
+    struct mixer *mixer = ops->open(TEST_CARD);
+    struct mixer_ctl *ctl;
+    unsigned int i;
+    int ret = -1;
+
+    if (!mixer)
+        return -1;
+    for (i = 0; i < ops->get_num_ctls(mixer); i++) {
+        ctl = ops->get_ctl(mixer, i);
+        if (strcmp(ops->ctl_get_name(ctl), name) == 0) {
+            ret = ops->ctl_set_value(ctl, id, value);
+            break;
+        }
+    }
+    ops->close(mixer);
+    return ret;
+}
+
+static struct audio_route *reinit(struct audio_route *ar, const struct test_files *files,
+                                  const char *mode)
+{
+    struct audio_route *new_ar;
+
+    if (mode && strcmp(mode, "shared") == 0) {
+        new_ar = audio_route_init_backend(TEST_CARD, files->xml, fake_mixer_ops());
+        audio_route_free(ar);
+        return new_ar;
+    }
+    audio_route_free(ar);
+    if (mode && strcmp(mode, "cached") == 0)
+        return audio_route_init_backend_cached(TEST_CARD, files->xml, files->cache,
+                                               fake_mixer_ops());
+    if (mode && strcmp(mode, "snapshot") == 0)
+        return audio_route_init_backend_snapshot(TEST_CARD, files->xml, NULL, files->snapshot,
+                                                 fake_mixer_ops());
+    return audio_route_init_backend(TEST_CARD, files->xml, fake_mixer_ops());
+}
+
+static int run_command(struct audio_route **ar_ptr, const struct test_files *files, char *line,
+                       FILE *log)
+{
+    struct audio_route *ar = *ar_ptr;
+    char *cmd, *arg, *arg2, *arg3, *saveptr;
+    char path[LINE_SIZE];
+    struct audio_route_path_refs refs[MAX_PATHS];
+    unsigned int num_refs;
+    int ret;
+    const char *names[MAX_PATHS];
+    unsigned int num_names = 0;
+
+    cmd = strtok_r(line, " \t", &saveptr);
+    if (!cmd || cmd[0] == '#')
+        return 0;
+    arg = strtok_r(NULL, strcmp(cmd, "refs") == 0 ? "" : " \t", &saveptr);
+    /* control names have spaces, they take the rest of the line */
+    arg2 = strtok_r(NULL, strcmp(cmd, "write_mode") == 0 || strcmp(cmd, "read_error") == 0 ?
+                    "" : " \t", &saveptr);
+
+    if (strcmp(cmd, "reinit") == 0) {
+        *ar_ptr = reinit(ar, files, arg);
+        return *ar_ptr ? 0 : -1;
+    }
+    if (strcmp(cmd, "snapshot") == 0)
+        return audio_route_save_snapshot(ar, files->snapshot);
+    if (strcmp(cmd, "worker") == 0) {
+        requests.ar = ar;
+        requests.log = log;
+        return audio_route_start_worker(ar);
+    }
+    if (strcmp(cmd, "hold") == 0) {
+        requests.hold = true;
+        return 0;
+    }
+    if (strcmp(cmd, "release") == 0)
+        return sem_post(&requests.release);
+    if (strcmp(cmd, "flush") == 0)
+        return audio_route_flush(ar);
+    if (strcmp(cmd, "update") == 0)
+        return audio_route_update_mixer(ar);
+    if (strcmp(cmd, "begin") == 0)
+        return audio_route_begin(ar);
+    if (strcmp(cmd, "commit") == 0)
+        return audio_route_commit(ar) < 0 ? -1 : 0;
+    if (strcmp(cmd, "reset_all") == 0) {
+        audio_route_reset(ar);
+        return 0;
+    }
+    if (strcmp(cmd, "ref_debug") == 0)
+        return audio_route_enable_ref_debug(ar, 1);
+    if (strcmp(cmd, "active_paths") == 0) {
+        ret = audio_route_get_active_paths(ar, refs, MAX_PATHS);
+        if (ret >= 0)
+            print_refs(log, "active paths:", refs, ret);
+        return ret;
+    }
+    if (strcmp(cmd, "ref_errors") == 0) {
+        fprintf(log, "reference errors: %lu\n", audio_route_get_ref_errors(ar));
+        return 0;
+    }
+
+    if (!arg)
+        return -1;
+    if (strcmp(cmd, "write_mode") == 0 && arg2) {
+        if (strcmp(arg, "full") == 0)
+            return audio_route_set_ctl_write_mode(ar, arg2, AUDIO_ROUTE_WRITE_FULL);
+        if (strcmp(arg, "delta") == 0)
+            return audio_route_set_ctl_write_mode(ar, arg2, AUDIO_ROUTE_WRITE_DELTA);
+        return audio_route_set_ctl_write_mode(ar, arg2, AUDIO_ROUTE_WRITE_AUTO);
+    }
+    if (strcmp(cmd, "apply") == 0)
+        return audio_route_apply_path(ar, arg);
+    if (strcmp(cmd, "reset") == 0)
+        return audio_route_reset_path(ar, arg);
+    if (strcmp(cmd, "apply_and_update") == 0)
+        return audio_route_apply_and_update_path(ar, arg);
+    if (strcmp(cmd, "reset_and_update") == 0)
+        return audio_route_reset_and_update_path(ar, arg);
+    if (strcmp(cmd, "force_reset_and_update") == 0)
+        return audio_route_force_reset_and_update_path(ar, arg);
+    if (strcmp(cmd, "submit") == 0 && arg2) {
+        arg3 = strtok_r(NULL, " \t", &saveptr);
+        return arg3 ? submit_request(ar, arg, arg2, arg3, strtok_r(NULL, " \t", &saveptr)) : -1;
+    }
+    if (strcmp(cmd, "read_error") == 0 && arg2)
+        return fake_mixer_set_read_error(TEST_CARD, arg2, strcmp(arg, "on") == 0);
+    if (strcmp(cmd, "set") == 0 && arg2) {
+        arg3 = strtok_r(NULL, "", &saveptr);
+        return arg3 ? set_card_value(arg3, atoi(arg), atoi(arg2)) : -1;
+    }
+    if (strcmp(cmd, "switch") == 0 && arg2)
+        return audio_route_switch_path(ar, arg, arg2);
+    if (strcmp(cmd, "apply_paths") == 0 || strcmp(cmd, "reset_paths") == 0) {
+        for (; arg && num_names < MAX_PATHS; arg = arg2, arg2 = strtok_r(NULL, " \t", &saveptr))
+            names[num_names++] = arg;
+        if (cmd[0] == 'a')
+            return audio_route_apply_and_update_paths(ar, names, num_names);
+        return audio_route_reset_and_update_paths(ar, names, num_names);
+    }
+    if (strcmp(cmd, "refs") == 0) {
+        ret = audio_route_get_ctl_refs(ar, arg, &num_refs, refs, MAX_PATHS);
+        if (ret >= 0) {
+            snprintf(path, sizeof(path), "%s: %u refs:", arg, num_refs);
+            print_refs(log, path, refs, ret);
+        }
+        return ret;
+    }
+    if (strcmp(cmd, "reload") == 0) {
+        snprintf(path, sizeof(path), "%s/%s", files->dir, arg);
+        return audio_route_reload(ar, path) < 0 ? -1 : 0;
+    }
+
+    return -1;
+}
+
+static int run_script(const char *dir, const char *card, const char *xml, const char *script,
+                      FILE *log)
+{
+    struct audio_route *ar;
+    char line[LINE_SIZE];
+    struct test_files files = {
+        .dir = dir,
+        .xml = xml,
+        .cache = "/tmp/audio_route_test.XXXXXX",
+        .snapshot = "/tmp/audio_route_test.XXXXXX",
+    };
+    unsigned int line_num = 0;
+    FILE *file;
+    int cache_fd, snapshot_fd = -1;
+    int ret = 0;
+
+    if (fake_mixer_load(TEST_CARD, card) < 0)
+        return -1;
+    fake_mixer_set_log(TEST_CARD, log);
+
+    file = fopen(script, "r");
+    if (!file) {
+        printf("unable to open %s\n", script);
+        fake_mixer_unload(TEST_CARD);
+        return -1;
+    }
+    sem_init(&requests.held, 0, 0);
+    sem_init(&requests.release, 0, 0);
+
+    cache_fd = mkstemp(files.cache);
+    if (cache_fd >= 0)
+        snapshot_fd = mkstemp(files.snapshot);
+    if (snapshot_fd < 0) {
+        printf("unable to create the temporary files\n");
+        ret = -1;
+        goto done;
+    }
+    close(cache_fd);
+    close(snapshot_fd);
+
+    fprintf(log, "# init\n");
+    ar = audio_route_init_backend(TEST_CARD, xml, fake_mixer_ops());
+    if (!ar) {
+        printf("audio_route_init_backend failed for %s\n", xml);
+        ret = -1;
+        goto done;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        fprintf(log, "# %s\n", line);
+        if (run_command(&ar, &files, line, log) < 0) {
+            printf("%s:%u: command failed\n", script, line_num);
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ar)
+        audio_route_free(ar);
+done:
+    if (cache_fd >= 0)
+        unlink(files.cache);
+    if (snapshot_fd >= 0)
+        unlink(files.snapshot);
+    sem_destroy(&requests.release);
+    sem_destroy(&requests.held);
+    fclose(file);
+    fake_mixer_unload(TEST_CARD);
+    return ret;
+}
+
+static int compare(FILE *log, const char *golden)
+{
+    char expected[LINE_SIZE];
+    char actual[LINE_SIZE];
+    unsigned int line_num = 0;
+    FILE *file = fopen(golden, "r");
+    bool more_expected, more_actual;
+
+    if (!file) {
+        printf("unable to open %s\n", golden);
+        return -1;
+    }
+
+    rewind(log);
+    for (;;) {
+        line_num++;
+        more_expected = fgets(expected, sizeof(expected), file) != NULL;
+        more_actual = fgets(actual, sizeof(actual), log) != NULL;
+        if (!more_expected && !more_actual)
+            break;
+        if (more_expected != more_actual || strcmp(expected, actual) != 0) {
+            printf("%s:%u: mismatch\n  expected: %s  actual:   %s", golden, line_num,
+                   more_expected ? expected : "<end>\n", more_actual ? actual : "<end>\n");
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *srcdir = getenv("srcdir");
+    const char *name = "routes";
+    const char *dir = "data";
+    char srcdir_data[LINE_SIZE / 2];
+    char card[LINE_SIZE], xml[LINE_SIZE], script[LINE_SIZE], golden[LINE_SIZE];
+    bool update = false;
+    FILE *log;
+    int opt;
+    int ret;
+
+    if (srcdir) {
+        snprintf(srcdir_data, sizeof(srcdir_data), "%s/data", srcdir);
+        dir = srcdir_data;
+    }
+    while ((opt = getopt(argc, argv, "d:n:uh")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        case 'u':
+            update = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    snprintf(card, sizeof(card), "%s/%s.card", dir, name);
+    snprintf(xml, sizeof(xml), "%s/%s.xml", dir, name);
+    snprintf(script, sizeof(script), "%s/%s.script", dir, name);
+    snprintf(golden, sizeof(golden), "%s/%s.golden", dir, name);
+
+    log = update ? fopen(golden, "w+") : tmpfile();
+    if (!log) {
+        printf("unable to open the write log\n");
+        return 1;
+    }
+
+    ret = run_script(dir, card, xml, script, log);
+    if (ret == 0 && !update)
+        ret = compare(log, golden);
+    fclose(log);
+
+    printf("%s: %s\n", name, ret == 0 ? (update ? "updated" : "PASS") : "FAIL");
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tinyalsa/asoundlib.h>
+#include "fake_mixer.h"
+
+#define LINE_SIZE 4096
+
+struct mixer_ctl {
+    char *name;
+    enum mixer_ctl_type type;
+    unsigned int num_values;
+    size_t value_size;
+    unsigned char *values;
+    unsigned int num_enums;
+    char **enum_names;
+    bool read_error;
+    struct mixer *mixer;
+};
+
+struct mixer {
+    struct mixer_ctl *ctls;
+    unsigned int num_ctls;
+    unsigned int read_latency_us;
+    unsigned int write_latency_us;
+    struct fake_mixer_stats stats;
+    FILE *log;
+};
+
+static struct mixer *cards[FAKE_MIXER_MAX_CARDS];
+
+static void inject_latency(unsigned int us)
+{
+    struct timespec ts;
+
+    if (!us)
+        return;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000L;
+    nanosleep(&ts, NULL);
+}
+
+static long ctl_value(struct mixer_ctl *ctl, unsigned int id)
+{
+    switch (ctl->type) {
+    case MIXER_CTL_TYPE_BYTE:
+        return ((unsigned char *)ctl->values)[id];
+    case MIXER_CTL_TYPE_ENUM:
+        return ((int *)ctl->values)[id];
+    case MIXER_CTL_TYPE_INT64:
+        return ((long long *)ctl->values)[id];
+    default:
+        return ((long *)ctl->values)[id];
+    }
+}
+
+/* a partial write is logged with its range, followed by the whole new value */
+static void log_write(struct mixer_ctl *ctl, size_t offset, size_t count)
+{
+    FILE *log = ctl->mixer->log;
+    unsigned int i;
+
+    if (!log)
+        return;
+    if (count < ctl->num_values)
+        fprintf(log, "%s @%zu+%zu:", ctl->name, offset, count);
+    else
+        fprintf(log, "%s:", ctl->name);
+    for (i = 0; i < ctl->num_values; i++)
+        fprintf(log, " %ld", ctl_value(ctl, i));
+    fprintf(log, "\n");
+}
+
+static int add_ctl(struct mixer *mixer, unsigned int *size, const char *type,
+                   unsigned int num_values, const char *name, char *items)
+{
+    struct mixer_ctl *ctl;
+    char *item, *saveptr;
+
+    if (mixer->num_ctls == *size) {
+        unsigned int new_size = *size ? *size * 2 : 64;
+        struct mixer_ctl *ctls = realloc(mixer->ctls, new_size * sizeof(*ctls));
+
+        if (!ctls)
+            return -1;
+        mixer->ctls = ctls;
+        *size = new_size;
+    }
+    ctl = &mixer->ctls[mixer->num_ctls];
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->mixer = mixer;
+    ctl->num_values = num_values;
+
+    if (strcmp(type, "bool") == 0) {
+        ctl->type = MIXER_CTL_TYPE_BOOL;
+        ctl->value_size = sizeof(long);
+    } else if (strcmp(type, "int") == 0) {
+        ctl->type = MIXER_CTL_TYPE_INT;
+        ctl->value_size = sizeof(long);
+    } else if (strcmp(type, "int64") == 0) {
+        ctl->type = MIXER_CTL_TYPE_INT64;
+        ctl->value_size = sizeof(long long);
+    } else if (strcmp(type, "byte") == 0) {
+        ctl->type = MIXER_CTL_TYPE_BYTE;
+        ctl->value_size = 1;
+    } else if (strcmp(type, "enum") == 0) {
+        ctl->type = MIXER_CTL_TYPE_ENUM;
+        ctl->value_size = sizeof(int);
+        ctl->num_values = 1;
+    } else {
+        fprintf(stderr, "fake_mixer: unknown control type %s\n", type);
+        return -1;
+    }
+
+    ctl->name = strdup(name);
+    ctl->values = calloc(ctl->num_values, ctl->value_size);
+    if (!ctl->name || !ctl->values)
+        goto err;
+
+    for (item = strtok_r(items, " \t", &saveptr); item;
+         item = strtok_r(NULL, " \t", &saveptr)) {
+        char **names = realloc(ctl->enum_names, (ctl->num_enums + 1) * sizeof(char *));
+
+        if (!names)
+            goto err;
+        ctl->enum_names = names;
+        ctl->enum_names[ctl->num_enums] = strdup(item);
+        if (!ctl->enum_names[ctl->num_enums])
+            goto err;
+        ctl->num_enums++;
+    }
+
+    mixer->num_ctls++;
+    return 0;
+
+err:
+    while (ctl->num_enums)
+        free(ctl->enum_names[--ctl->num_enums]);
+    free(ctl->enum_names);
+    free(ctl->values);
+    free(ctl->name);
+    return -1;
+}
+
+static int parse_line(struct mixer *mixer, unsigned int *size, char *line)
+{
+    char type[16];
+    char name[LINE_SIZE];
+    unsigned int num_values;
+    unsigned int us;
+    char *items;
+    int pos;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    line += strspn(line, " \t");
+    if (*line == '\0' || *line == '#')
+        return 0;
+
+    if (sscanf(line, "latency read %u", &us) == 1) {
+        mixer->read_latency_us = us;
+        return 0;
+    }
+    if (sscanf(line, "latency write %u", &us) == 1) {
+        mixer->write_latency_us = us;
+        return 0;
+    }
+
+    if (strncmp(line, "enum ", 5) == 0) {
+        items = strchr(line + 5, ':');
+        if (!items)
+            return -1;
+        *items++ = '\0';
+        return add_ctl(mixer, size, "enum", 1, line + 5, items);
+    }
+
+    if (sscanf(line, "%15s %u %n", type, &num_values, &pos) != 2 || !line[pos])
+        return -1;
+    snprintf(name, sizeof(name), "%s", line + pos);
+    return add_ctl(mixer, size, type, num_values, name, "");
+}
+
+static void free_mixer(struct mixer *mixer)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < mixer->num_ctls; i++) {
+        for (j = 0; j < mixer->ctls[i].num_enums; j++)
+            free(mixer->ctls[i].enum_names[j]);
+        free(mixer->ctls[i].enum_names);
+        free(mixer->ctls[i].values);
+        free(mixer->ctls[i].name);
+    }
+    free(mixer->ctls);
+    free(mixer);
+}
+
+int fake_mixer_load(unsigned int card, const char *path)
+{
+    struct mixer *mixer;
+    unsigned int size = 0;
+    unsigned int line_num = 0;
+    char *line;
+    FILE *file;
+
+    if (card >= FAKE_MIXER_MAX_CARDS)
+        return -1;
+
+    file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "fake_mixer: unable to open %s\n", path);
+        return -1;
+    }
+
+    mixer = calloc(1, sizeof(*mixer));
+    line = malloc(LINE_SIZE);
+    if (!mixer || !line)
+        goto err;
+
+    while (fgets(line, LINE_SIZE, file)) {
+        line_num++;
+        if (parse_line(mixer, &size, line) < 0) {
+            fprintf(stderr, "fake_mixer: %s:%u: invalid line\n", path, line_num);
+            goto err;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    fake_mixer_unload(card);
+    cards[card] = mixer;
+    return 0;
+
+err:
+    if (mixer)
+        free_mixer(mixer);
+    free(line);
+    fclose(file);
+    return -1;
+}
+
+void fake_mixer_unload(unsigned int card)
+{
+    if (card >= FAKE_MIXER_MAX_CARDS || !cards[card])
+        return;
+
+    free_mixer(cards[card]);
+    cards[card] = NULL;
+}
+
+unsigned int fake_mixer_num_ctls(unsigned int card)
+{
+    if (card >= FAKE_MIXER_MAX_CARDS || !cards[card])
+        return 0;
+
+    return cards[card]->num_ctls;
+}
+
+void fake_mixer_get_stats(unsigned int card, struct fake_mixer_stats *stats)
+{
+    if (card >= FAKE_MIXER_MAX_CARDS || !cards[card]) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+
+    *stats = cards[card]->stats;
+}
+
+void fake_mixer_reset_stats(unsigned int card)
+{
+    if (card < FAKE_MIXER_MAX_CARDS && cards[card])
+        memset(&cards[card]->stats, 0, sizeof(cards[card]->stats));
+}
+
+void fake_mixer_set_log(unsigned int card, FILE *log)
+{
+    if (card < FAKE_MIXER_MAX_CARDS && cards[card])
+        cards[card]->log = log;
+}
+
+int fake_mixer_set_read_error(unsigned int card, const char *name, bool fail)
+{
+    unsigned int i;
+
+    if (card >= FAKE_MIXER_MAX_CARDS || !cards[card])
+        return -1;
+
+    for (i = 0; i < cards[card]->num_ctls; i++) {
+        if (strcmp(cards[card]->ctls[i].name, name) == 0) {
+            cards[card]->ctls[i].read_error = fail;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* mixer backend */
+
+static struct mixer *fake_open(unsigned int card)
+{
+    return card < FAKE_MIXER_MAX_CARDS ? cards[card] : NULL;
+}
+
+static void fake_close(struct mixer *mixer)
+{
+    /* the card outlives its users, see fake_mixer_unload() */
+    (void)mixer;
+}
+
+static unsigned int fake_get_num_ctls(struct mixer *mixer)
+{
+    return mixer->num_ctls;
+}
+
+static struct mixer_ctl *fake_get_ctl(struct mixer *mixer, unsigned int id)
+{
+    return id < mixer->num_ctls ? &mixer->ctls[id] : NULL;
+}
+
+static const char *fake_ctl_get_name(struct mixer_ctl *ctl)
+{
+    return ctl->name;
+}
+
+static int fake_ctl_get_type(struct mixer_ctl *ctl)
+{
+    return ctl->type;
+}
+
+static unsigned int fake_ctl_get_num_values(struct mixer_ctl *ctl)
+{
+    return ctl->num_values;
+}
+
+static unsigned int fake_ctl_get_num_enums(struct mixer_ctl *ctl)
+{
+    return ctl->num_enums;
+}
+
+static const char *fake_ctl_get_enum_string(struct mixer_ctl *ctl, unsigned int enum_id)
+{
+    return enum_id < ctl->num_enums ? ctl->enum_names[enum_id] : NULL;
+}
+
+static int fake_ctl_get_value(struct mixer_ctl *ctl, unsigned int id)
+{
+    if (id >= ctl->num_values || ctl->read_error)
+        return -1;
+
+    inject_latency(ctl->mixer->read_latency_us);
+    ctl->mixer->stats.reads++;
+    return (int)ctl_value(ctl, id);
+}
+
+static int fake_ctl_get_array(struct mixer_ctl *ctl, void *array, size_t count)
+{
+    if (count > ctl->num_values || ctl->read_error)
+        return -1;
+
+    inject_latency(ctl->mixer->read_latency_us);
+    ctl->mixer->stats.reads++;
+    memcpy(array, ctl->values, count * ctl->value_size);
+    return 0;
+}
+
+static int fake_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value)
+{
+    if (id >= ctl->num_values)
+        return -1;
+
+    switch (ctl->type) {
+    case MIXER_CTL_TYPE_BYTE:
+        ((unsigned char *)ctl->values)[id] = value;
+        break;
+    case MIXER_CTL_TYPE_ENUM:
+        if ((unsigned int)value >= ctl->num_enums)
+            return -1;
+        ((int *)ctl->values)[id] = value;
+        break;
+    case MIXER_CTL_TYPE_INT64:
+        ((long long *)ctl->values)[id] = value;
+        break;
+    default:
+        ((long *)ctl->values)[id] = value;
+        break;
+    }
+
+    inject_latency(ctl->mixer->write_latency_us);
+    ctl->mixer->stats.writes++;
+    ctl->mixer->stats.bytes_written += ctl->value_size;
+    log_write(ctl, 0, ctl->num_values);
+    return 0;
+}
+
+static int fake_ctl_set_array(struct mixer_ctl *ctl, const void *array, size_t count)
+{
+    if (count > ctl->num_values)
+        return -1;
+
+    memcpy(ctl->values, array, count * ctl->value_size);
+    inject_latency(ctl->mixer->write_latency_us);
+    ctl->mixer->stats.writes++;
+    ctl->mixer->stats.bytes_written += count * ctl->value_size;
+    log_write(ctl, 0, ctl->num_values);
+    return 0;
+}
+
+static int fake_ctl_set_array_range(struct mixer_ctl *ctl, const void *array, size_t offset,
+                                    size_t count)
+{
+    if (offset > ctl->num_values || count > ctl->num_values - offset)
+        return -1;
+
+    memcpy(ctl->values + offset * ctl->value_size, array, count * ctl->value_size);
+    inject_latency(ctl->mixer->write_latency_us);
+    ctl->mixer->stats.writes++;
+    ctl->mixer->stats.range_writes++;
+    ctl->mixer->stats.bytes_written += count * ctl->value_size;
+    log_write(ctl, offset, count);
+    return 0;
+}
+
+static const struct audio_route_mixer_ops fake_ops = {
+    .open = fake_open,
+    .close = fake_close,
+    .get_num_ctls = fake_get_num_ctls,
+    .get_ctl = fake_get_ctl,
+    .ctl_get_name = fake_ctl_get_name,
+    .ctl_get_type = fake_ctl_get_type,
+    .ctl_get_num_values = fake_ctl_get_num_values,
+    .ctl_get_num_enums = fake_ctl_get_num_enums,
+    .ctl_get_enum_string = fake_ctl_get_enum_string,
+    .ctl_get_value = fake_ctl_get_value,
+    .ctl_get_array = fake_ctl_get_array,
+    .ctl_set_value = fake_ctl_set_value,
+    .ctl_set_array = fake_ctl_set_array,
+    .ctl_set_array_range = fake_ctl_set_array_range,
+};
+
+const struct audio_route_mixer_ops *fake_mixer_ops(void)
+{
+    return &fake_ops;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+#ifndef FAKE_MIXER_H
+#define FAKE_MIXER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <audio_route/audio_route.h>
+
+#define FAKE_MIXER_MAX_CARDS 8
+
+/* kernel calls made on a fake card */
+struct fake_mixer_stats {
+    unsigned long reads;
+    unsigned long writes;
+    /* writes of part of an array, included in writes */
+    unsigned long range_writes;
+    unsigned long bytes_written;
+};
+
+/*
+ * Load the controls of a fake card from a description file, one control or
+ * setting per line:
+ *
+ *   bool|int|int64|byte <num_values> <name>
+ *   enum <name>: <item> <item> ...
+ *   latency read|write <us>
+ *
+ * Lines starting with '#' are comments. Control values start at zero; the
+ * latency is added to every control read or write. The card keeps its
+ * values across opens, like real hardware, until fake_mixer_unload().
+ */
+int fake_mixer_load(unsigned int card, const char *path);
+void fake_mixer_unload(unsigned int card);
+
+/* backend for audio_route_init_backend() */
+const struct audio_route_mixer_ops *fake_mixer_ops(void);
+
+unsigned int fake_mixer_num_ctls(unsigned int card);
+void fake_mixer_get_stats(unsigned int card, struct fake_mixer_stats *stats);
+void fake_mixer_reset_stats(unsigned int card);
+
+/*
+ * Log every control write as "name: value value ..." to log, or stop if
+ * NULL. Partial writes log "name @offset+count: ..." with the whole value.
+ */
+void fake_mixer_set_log(unsigned int card, FILE *log);
+
+/* make the reads of a control fail, or work again; -1 if there is no such control */
+int fake_mixer_set_read_error(unsigned int card, const char *name, bool fail);
+
+#endif
@@ -0,0 +1,109 @@
+#    Call flow renderer for mem logger
+#    Copyright (c) Qualcomm Innovation Center, Inc. All rights reserved.
+#    SPDX-License-Identifier: BSD-3-Clause-Clear
+#
+#    Renders PAL state sequences locally as an SVG sequence diagram and a
+#    PlantUML text file. Messages are written out as they are added, so
+#    memory stays flat on large dumps; only the participant lifelines and
+#    the document header are emitted when the flow is closed.
+import tempfile
+from xml.sax.saxutils import escape
+
+COLUMN_WIDTH = 180
+ROW_HEIGHT = 34
+LINE_HEIGHT = 14
+MARGIN = 20
+HEADER_HEIGHT = 60
+BOX_HEIGHT = 26
+
+class CallFlow:
+
+    def __init__(self, path, title, participants=None):
+        self.svgPath = path + ".svg"
+        self.pumlPath = path + ".puml"
+        self.title = title
+        self.columns = {}
+        self.y = HEADER_HEIGHT + BOX_HEIGHT + MARGIN
+        self.body = tempfile.TemporaryFile(mode="w+")
+        self.puml = open(self.pumlPath, "w")
+        self.puml.write("@startuml\ntitle " + title + "\n")
+        for name in participants or []:
+            self.column(name)
+
+    def column(self, name):
+        #participants get a column the first time they are seen
+        if name not in self.columns:
+            self.columns[name] = len(self.columns)
+            self.puml.write('participant "' + name + '" as ' + self.alias(name) + "\n")
+        return MARGIN + COLUMN_WIDTH // 2 + self.columns[name] * COLUMN_WIDTH
+
+    def alias(self, name):
+        return "p" + str(self.columns[name])
+
+    def transition(self, src, dst, label):
+        x1 = self.column(src)
+        x2 = self.column(dst)
+        self.puml.write(self.alias(src) + " -> " + self.alias(dst) + " : " + label + "\n")
+
+        y = self.y + LINE_HEIGHT
+        self.body.write('<text x="%d" y="%d" text-anchor="middle">%s</text>\n'
+                        % ((x1 + x2) // 2, y - 4, escape(label)))
+        if x1 == x2:
+            self.body.write('<path d="M%d %d h30 v10 h-30" class="msg"/>\n' % (x1, y))
+        else:
+            self.body.write('<line x1="%d" y1="%d" x2="%d" y2="%d" class="msg"/>\n'
+                            % (x1, y, x2, y))
+        self.y += ROW_HEIGHT
+
+    def note(self, src, dst, lines):
+        x1 = self.column(src)
+        x2 = self.column(dst)
+        self.puml.write("note over " + self.alias(src) + ", " + self.alias(dst) + "\n")
+        for line in lines:
+            self.puml.write(line + "\n")
+        self.puml.write("end note\n")
+
+        left = min(x1, x2) - COLUMN_WIDTH // 2 + 10
+        width = abs(x2 - x1) + COLUMN_WIDTH - 20
+        height = LINE_HEIGHT * len(lines) + 10
+        self.body.write('<rect x="%d" y="%d" width="%d" height="%d" class="note"/>\n'
+                        % (left, self.y, width, height))
+        for i, line in enumerate(lines):
+            self.body.write('<text x="%d" y="%d" text-anchor="middle">%s</text>\n'
+                            % (left + width // 2, self.y + LINE_HEIGHT * (i + 1), escape(line)))
+        self.y += height + ROW_HEIGHT - LINE_HEIGHT
+
+    def close(self):
+        self.puml.write("@enduml\n")
+        self.puml.close()
+
+        width = 2 * MARGIN + max(len(self.columns), 1) * COLUMN_WIDTH
+        height = self.y + MARGIN
+        with open(self.svgPath, "w") as svg:
+            svg.write('<svg xmlns="http://www.w3.org/2000/svg" width="%d" height="%d" '
+                      'font-family="sans-serif" font-size="11">\n' % (width, height))
+            svg.write('<defs><marker id="arrow" markerWidth="8" markerHeight="8" refX="8" refY="4" '
+                      'orient="auto"><path d="M0,0 L8,4 L0,8 z"/></marker></defs>\n')
+            svg.write('<style>.msg{stroke:#000;fill:none;marker-end:url(#arrow)}'
+                      '.life{stroke:#888;stroke-dasharray:4}'
+                      '.box{fill:#d8f0d0;stroke:#3a7a30}'
+                      '.note{fill:#fffbd0;stroke:#a09040}</style>\n')
+            svg.write('<text x="%d" y="%d" text-anchor="middle" font-size="14">%s</text>\n'
+                      % (width // 2, MARGIN + 10, escape(self.title)))
+            for name in self.columns:
+                x = self.column(name)
+                svg.write('<line x1="%d" y1="%d" x2="%d" y2="%d" class="life"/>\n'
+                          % (x, HEADER_HEIGHT + BOX_HEIGHT, x, height - MARGIN))
+                svg.write('<rect x="%d" y="%d" width="%d" height="%d" rx="6" class="box"/>\n'
+                          % (x - COLUMN_WIDTH // 2 + 10, HEADER_HEIGHT, COLUMN_WIDTH - 20, BOX_HEIGHT))
+                svg.write('<text x="%d" y="%d" text-anchor="middle">%s</text>\n'
+                          % (x, HEADER_HEIGHT + BOX_HEIGHT // 2 + 4, escape(name)))
+            #copy the messages written so far in bounded chunks
+            self.body.seek(0)
+            while True:
+                chunk = self.body.read(1 << 16)
+                if not chunk:
+                    break
+                svg.write(chunk)
+            svg.write("</svg>\n")
+        self.body.close()
@@ -0,0 +1,231 @@
+#    Columnar export file for mem logger
+#    Copyright (c) Qualcomm Innovation Center, Inc. All rights reserved.
+#    SPDX-License-Identifier: BSD-3-Clause-Clear
+#
+#    Decodes mem logger bin files straight into Apache Arrow tables, one
+#    column per struct field. Enum fields are written as dictionary encoded
+#    columns using the names from enum_replacements.xml and timestamps are
+#    kept as int64 milliseconds, so dumps can be bulk loaded and filtered
+#    by stream handle or device without reparsing text output.
+#    Requires numpy and pyarrow.
+import os
+from struct import calcsize
+import memLoggerUtils
+
+util = memLoggerUtils.MemLoggerUtil()
+
+FORMATS = ("arrow", "parquet")
+
+#struct format code -> numpy type, native byte order as with '@'
+NUMPY_TYPES = {"Q": "u8", "q": "i8", "I": "u4", "i": "i4", "H": "u2", "h": "i2",
+               "B": "u1", "b": "i1", "?": "?", "s": "S"}
+
+#column names and enum types in struct order, see armemlog/inc/*_queue.h
+PAL_STATE_COLUMNS = [
+    ("timestamp", None),
+    ("stream_handle", None),
+    ("dev_1_sample_rate", None), ("dev_1_device", "pal_device_id_t"),
+    ("dev_1_bit_width", None), ("dev_1_channels", None),
+    ("dev_2_sample_rate", None), ("dev_2_device", "pal_device_id_t"),
+    ("dev_2_bit_width", None), ("dev_2_channels", None),
+    ("dev_3_sample_rate", None), ("dev_3_device", "pal_device_id_t"),
+    ("dev_3_bit_width", None), ("dev_3_channels", None),
+    ("state", "stream_state_t"),
+    ("error", None),
+    ("stream_type", "pal_stream_type_t"),
+    ("direction", "pal_stream_direction_t"),
+    ("session_handle", None),
+]
+ACD_COLUMNS = [
+    ("acd_state_id", None),
+    ("acd_eng_state_id", None),
+    ("acd_event_id", None),
+    ("acd_context_id", None),
+    ("acd_capture_profile", None),
+    ("acd_model_id", None),
+]
+KPI_COLUMNS = [
+    ("timestamp", None),
+    ("pid", None),
+    ("func_name", None),
+    ("type", None),
+]
+GRAPH_COLUMNS = [
+    ("timestamp", None),
+    ("state", "graph_state"),
+    ("result", "exit_codes"),
+    ("stream_handle", None),
+]
+SPF_RESET_COLUMNS = [
+    ("timestamp", None),
+    ("state", "spf_reset_state"),
+]
+
+def expandFormat(format):
+    #split a struct format into (byte order, [codes]) with repeat counts expanded
+    order = ""
+    if format and format[0] in "@=<>!":
+        order = format[0]
+        format = format[1:]
+    codes = []
+    count = ""
+    for c in format:
+        if c.isdigit():
+            count += c
+        elif c == "s":
+            codes.append(count + c)
+            count = ""
+        else:
+            codes.extend([c] * (int(count) if count else 1))
+            count = ""
+    return order, codes
+
+def formatToDtype(format, names, baseOffset=0, itemsize=None):
+    #build a numpy record type with the same layout struct.unpack uses
+    import numpy as np
+    order, codes = expandFormat(format)
+    if len(codes) != len(names):
+        raise ValueError("format " + format + " has " + str(len(codes)) +
+                         " fields but " + str(len(names)) + " names")
+    offsets = []
+    formats = []
+    prefix = order
+    for code in codes:
+        offsets.append(baseOffset + calcsize(prefix + "0" + code[-1]))
+        if code[-1] == "s":
+            formats.append("S" + (code[:-1] or "1"))
+        else:
+            formats.append(NUMPY_TYPES[code])
+        prefix += code
+    return np.dtype({"names": names, "formats": formats, "offsets": offsets,
+                     "itemsize": itemsize or calcsize(format)})
+
+def mergeDtypes(base, union, itemsize):
+    import numpy as np
+    names = list(base.names) + list(union.names)
+    fields = [base.fields[n] for n in base.names] + [union.fields[n] for n in union.names]
+    return np.dtype({"names": names, "formats": [f[0] for f in fields],
+                     "offsets": [f[1] for f in fields], "itemsize": itemsize})
+
+def readRecords(inFile, dtype):
+    import numpy as np
+    count = os.stat(inFile).st_size // dtype.itemsize
+    return np.fromfile(inFile, dtype=dtype, count=count)
+
+def enumColumn(values, enumType, mask=None):
+    #dictionary encode: one name lookup per distinct value, not per row
+    import numpy as np
+    import pyarrow as pa
+    uniques, indices = np.unique(values, return_inverse=True)
+    names = [util.getEnumToString(enumType, int(v)) for v in uniques]
+    indices = pa.array(indices.astype(np.int32), mask=mask)
+    return pa.DictionaryArray.from_arrays(indices, pa.array(names, pa.string()))
+
+def stringColumn(values, mask=None):
+    import pyarrow as pa
+    strings = [v.split(b"\0", 1)[0].decode("utf-8", "replace") for v in values]
+    return pa.array(strings, pa.string(), mask=mask).dictionary_encode()
+
+def buildTable(records, columns, masks=None):
+    import numpy as np
+    import pyarrow as pa
+    if masks is None:
+        masks = {}
+    arrays = []
+    for name, enumType in columns:
+        values = records[name]
+        mask = masks.get(name)
+        if enumType is not None:
+            arrays.append(enumColumn(values, enumType, mask))
+        elif values.dtype.kind == "S":
+            arrays.append(stringColumn(values, mask))
+        elif name == "timestamp":
+            arrays.append(pa.array(values.astype(np.int64), pa.int64(), mask=mask))
+        else:
+            arrays.append(pa.array(values, mask=mask))
+    return pa.Table.from_arrays(arrays, names=[name for name, _ in columns])
+
+def palStateTable(inFile):
+    import numpy as np
+    FORMAT = util.getFormat("PAL_STATE_QUEUE")
+    ACD_FORMAT = util.getFormat("acd_info")
+    baseSize = calcsize(FORMAT)
+    totalSize = baseSize + calcsize(ACD_FORMAT)
+    base = formatToDtype(FORMAT, [name for name, _ in PAL_STATE_COLUMNS], 0, baseSize)
+    acd = formatToDtype(ACD_FORMAT, [name for name, _ in ACD_COLUMNS], baseSize, totalSize)
+    records = readRecords(inFile, mergeDtypes(base, acd, totalSize))
+
+    #the union is only meaningful for ACD streams, null it out elsewhere
+    acdType = [int(item.getAttribute("value"), 0) for item in
+               util.enums.getElementsByTagName("pal_stream_type_t")[0].getElementsByTagName("item")
+               if item.getAttribute("name") == "ACD"]
+    notAcd = ~np.isin(records["stream_type"], acdType)
+    masks = {name: notAcd for name, _ in ACD_COLUMNS}
+    return buildTable(records, PAL_STATE_COLUMNS + ACD_COLUMNS, masks)
+
+def kpiTable(inFile):
+    FORMAT = util.getFormat("KPI_QUEUE")
+    dtype = formatToDtype(FORMAT, [name for name, _ in KPI_COLUMNS])
+    return buildTable(readRecords(inFile, dtype), KPI_COLUMNS)
+
+def graphQueueTable(inFile):
+    import numpy as np
+    FORMAT = util.getFormat("GRAPH_QUEUE")
+    dtype = formatToDtype(FORMAT, [name for name, _ in GRAPH_COLUMNS])
+    records = readRecords(inFile, dtype)
+    #result is a negative errno, exit_codes holds the positive value
+    result = -records["result"].view(np.int32)
+    records = records.copy()
+    records["result"] = result.view(np.uint32)
+    return buildTable(records, GRAPH_COLUMNS)
+
+def spfResetQueueTable(inFile):
+    FORMAT = util.getFormat("SPF_RESET_QUEUE")
+    dtype = formatToDtype(FORMAT, [name for name, _ in SPF_RESET_COLUMNS])
+    return buildTable(readRecords(inFile, dtype), SPF_RESET_COLUMNS)
+
+def statbufTable(inFile, name, enumType):
+    import numpy as np
+    import pyarrow as pa
+    dtype = formatToDtype(util.getFormat(name), ["count"])
+    counts = readRecords(inFile, dtype)["count"]
+    states = enumColumn(np.arange(len(counts)), enumType)
+    return pa.Table.from_arrays([states, pa.array(counts)], names=["state", "count"])
+
+def binToTable(inFile):
+    #same file name dispatch as memLoggerParser.parseBin
+    if "pal_state_queue" in inFile:
+        return palStateTable(inFile)
+    elif "kpi_queue" in inFile:
+        return kpiTable(inFile)
+    elif "graph" in inFile:
+        if "queue" in inFile:
+            return graphQueueTable(inFile)
+        elif "statbuf" in inFile:
+            return statbufTable(inFile, "GRAPH_STATBUF", "graph_state")
+    elif "spf_reset" in inFile:
+        if "queue" in inFile:
+            return spfResetQueueTable(inFile)
+        elif "statbuf" in inFile:
+            return statbufTable(inFile, "SPF_RESET_STATBUF", "spf_reset_state")
+    return None
+
+def exportColumnar(inFile, format, outputDir):
+    table = binToTable(inFile)
+    if table is None:
+        print("do not know how to export file " + inFile)
+        return None
+
+    output_file_name = os.path.splitext(os.path.basename(inFile))
+    if format == "parquet":
+        import pyarrow.parquet as pq
+        path = os.path.join(outputDir, output_file_name[0] + ".parquet")
+        pq.write_table(table, path)
+    else:
+        import pyarrow as pa
+        path = os.path.join(outputDir, output_file_name[0] + ".arrow")
+        with pa.OSFile(path, "wb") as sink:
+            with pa.ipc.new_file(sink, table.schema) as writer:
+                writer.write_table(table)
+    print("generating file " + path + " (" + str(table.num_rows) + " rows)")
+    return path
@@ -3,13 +3,35 @@
 #    SPDX-License-Identifier: BSD-3-Clause-Clear
 import sys
 import os
+from concurrent.futures import ProcessPoolExecutor
 import memLoggerUtils
 
 util = memLoggerUtils.MemLoggerUtil()
 #import state_parser
 #import kpi_parser
 
-def parseBin(inFile, display, callflow):
+def parseFile(file, display, callflow, columnar, outputDir):
+    import state_parser
+    import kpi_parser
+    import graph_parser
+    import spf_reset_parser
+    import columnar_export
+    if columnar:
+        columnar_export.exportColumnar(file, columnar, outputDir)
+    elif "pal_state_queue" in file:
+        state_parser.parsePalStateBin(file, display, callflow, outputDir)
+    elif "kpi_queue" in file:
+        kpi_parser.parseKPIBin(file, display, outputDir)
+    elif "graph" in file:
+        graph_parser.parseGraphBin(file, display, outputDir)
+    elif "spf_reset" in file:
+        spf_reset_parser.parseSPFResetBin(file, display, outputDir)
+    else:
+        print("do not know how to praser file "+ file)
+    #workers exit without flushing
+    sys.stdout.flush()
+
+def parseBin(inFile, display, callflow, columnar=None, jobs=1):
 
     # Get the current working directory
     cwd = os.getcwd()
@@ -18,10 +40,6 @@ def parseBin(inFile, display, callflow):
     full_path = os.path.realpath(__file__)
     path, filename = os.path.split(full_path)
     os.chdir(path)
-    import state_parser
-    import kpi_parser
-    import graph_parser
-    import spf_reset_parser
     binFiles = []
 
     #parse all files if dir is passed
@@ -32,21 +50,21 @@ def parseBin(inFile, display, callflow):
                 binFiles.append(f)
     elif os.path.isfile(inFile):
         binFiles.append(inFile)
-    for file in binFiles:
-        if "pal_state_queue" in file:
-            state_parser.parsePalStateBin(file, display, callflow, outputDir)
-        elif "kpi_queue" in file:
-            kpi_parser.parseKPIBin(file, display, outputDir)
-        elif "graph" in file:
-            graph_parser.parseGraphBin(file, display, outputDir)
-        elif "spf_reset" in file:
-            spf_reset_parser.parseSPFResetBin(file, display, outputDir)
-        else:
-            print("do not know how to praser file "+ file)
+
+    #each file is independent, fan them out unless output goes to stdout
+    if jobs > 1 and len(binFiles) > 1 and not display:
+        with ProcessPoolExecutor(max_workers=jobs) as pool:
+            results = [pool.submit(parseFile, file, display, callflow, columnar, outputDir)
+                       for file in binFiles]
+            for result in results:
+                result.result()
+    else:
+        for file in binFiles:
+            parseFile(file, display, callflow, columnar, outputDir)
 
 def main():
     args = util.argparser()
-    parseBin(args.fileName, args.display, args.callflow)
+    parseBin(args.fileName, args.display, args.callflow, args.columnar, args.jobs)
 
 
 if __name__ == "__main__":
@@ -4,12 +4,9 @@
 from xml.dom import minidom
 from datetime import datetime
 import io
-from urllib import request, parse
-import json
 import argparse
 import os
 
-WEBSEQ = 'http://webseq.qualcomm.com/'
 ENUM_CONFIG = "./enum_replacements.xml"
 CONFIG = "./config.xml"
 
@@ -26,6 +23,8 @@ class MemLoggerUtil:
         parser.add_argument('-f', '--file', dest='fileName', type=str, help='location of bin file to parse')
         parser.add_argument('-d', '--display', default=False, action=argparse.BooleanOptionalAction, help='print output to stdout instead of a file')
         parser.add_argument( '--callflow', default=False, action=argparse.BooleanOptionalAction, help='generates call flow')
+        parser.add_argument('-j', '--jobs', type=int, default=1, help='number of bin files to parse in parallel, default 1 (serial)')
+        parser.add_argument( '--columnar', choices=['arrow', 'parquet'], default=None, help='export records as an Arrow IPC or Parquet file instead of text')
         args=parser.parse_args()
         return args
 
@@ -43,32 +42,19 @@ class MemLoggerUtil:
         format = config.getAttribute("format")
         return format
 
-    def getEnumToString(self, type, value):
-        val = str(value)
-        enum = self.enums.getElementsByTagName(type)[0]
-        items = enum.getElementsByTagName("item")
-        for item in items:
-            if int(item.getAttribute("value"),0) == value:
-                val = item.getAttribute("name")
-                break
-        return val
-
-    def generate_callflow_image(self, callflow, fileName):
-        req_data = {
-            'message': callflow,
-            'apiVersion': '1',
-            'format': 'png',
-            'style': 'roundgreen'
-        }
-        encoded_req_data = parse.urlencode(req_data).encode()
-        req =  request.Request(WEBSEQ, data = encoded_req_data)
-        resp = request.urlopen(req)
-        resp_obj = json.loads(resp.read().decode('utf-8'))
+    enumTables = {}
 
-        png_url = request.urlopen(WEBSEQ + resp_obj['img'])
-        with open(fileName, "wb") as file:
-            file.write(png_url.read())
-            file.close()
+    def getEnumToString(self, type, value):
+        #build a value to name table per enum type on first use
+        table = self.enumTables.get(type)
+        if table is None:
+            table = {}
+            enum = self.enums.getElementsByTagName(type)[0]
+            items = enum.getElementsByTagName("item")
+            for item in items:
+                table.setdefault(int(item.getAttribute("value"),0), item.getAttribute("name"))
+            self.enumTables[type] = table
+        return table.get(value, str(value))
 
     def createLogDir(self):
         dir = "parsedLogs"
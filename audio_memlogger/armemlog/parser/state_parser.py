@@ -6,6 +6,7 @@ from datetime import datetime
 import sys
 import os
 import memLoggerUtils
+import callflow
 
 util = memLoggerUtils.MemLoggerUtil()
 
@@ -39,7 +40,9 @@ def parsePalStateBin(inFile, display, callflowEnabled, outputDir):
     output_file_name = os.path.splitext(os.path.basename(inFile))
     #print("base : "+ str(baseSize) + " union : " + str(unionSize) + " Total Size: " + str(totalSize))
     if callflowEnabled:
-        callFlow = "title Pal State Sequence\n\n"
+        callFlowName = output_file_name[0] + "_CallFlow"
+        callFlow = callflow.CallFlow(os.path.join(outputDir, callFlowName), "Pal State Sequence",
+                                     ["STREAM_CLOSED"])
     original_stdout = sys.stdout # Save a reference to the original standard output
     openStreams = []
     errorStreams = []
@@ -80,9 +83,9 @@ def parsePalStateBin(inFile, display, callflowEnabled, outputDir):
                     type = util.getEnumToString("pal_stream_type_t", qItem[STREAM_TYPE])
                     handle = hex(int(qItem[STREAM_HANDLE]))
                     if qItem[ERROR_CODE] != 0:
-                        callFlow += "note over "+state+","+newState+"\n"+type+"("+handle+")\nTransition to "+ newState+ " FAILED\nend note\n"
+                        callFlow.note(state, newState, [type+"("+handle+")", "Transition to "+ newState+ " FAILED"])
                     else:
-                        callFlow += state + " -> " +newState +": "+type+"("+handle+")\n"
+                        callFlow.transition(state, newState, type+"("+handle+")")
                 #only remove and item if transition was a success
                 if qItem[ERROR_CODE] == 0:
                     openStreams.remove(item)
@@ -94,7 +97,7 @@ def parsePalStateBin(inFile, display, callflowEnabled, outputDir):
                 if state == "STREAM_OPENED":
                     type = util.getEnumToString("pal_stream_type_t", qItem[STREAM_TYPE])
                     handle = hex(int(qItem[STREAM_HANDLE]))
-                    callFlow += "STREAM_CLOSED -> " + state +": "+type+"("+handle+")\n"
+                    callFlow.transition("STREAM_CLOSED", state, type+"("+handle+")")
         if qItem[ERROR_CODE] != 0:
             errorStreams.append(qItem)
 
@@ -120,10 +123,8 @@ def parsePalStateBin(inFile, display, callflowEnabled, outputDir):
             print('generating file '+ outputDir + "\\" + output_file_name[0] +'.txt')
 
     if(callflowEnabled):
-        callFlowName = output_file_name[0] + "_CallFlow.png"
-        print("generating callflow: "+ outputDir + "\\" +callFlowName)
-        path = os.path.join(outputDir, callFlowName)
-        util.generate_callflow_image(callFlow, path)
+        callFlow.close()
+        print("generating callflow: "+ callFlow.svgPath)
 
 def writeItem(item):
     #timeStamp, handle, sr1, d1, bw1, c1, sr2, d2, bw2, c2, sr3, d3, bw3, c3, state, streamType, direction, error, sHandle, = item
@@ -0,0 +1,259 @@
+#    Timeline Parser file for mem logger
+#    Copyright (c) Qualcomm Innovation Center, Inc. All rights reserved.
+#    SPDX-License-Identifier: BSD-3-Clause-Clear
+#
+#    Merges the PAL state, graph, SPF reset and KPI queue dumps of one dump
+#    epoch into a single timeline ordered by timestamp and reports per
+#    stream latencies. Each bin file is decoded in fixed size chunks and
+#    the queues are combined with a k-way heap merge, so memory stays
+#    bounded by the number of live streams rather than the dump size.
+from struct import calcsize, iter_unpack
+from datetime import datetime
+import heapq
+import ctypes
+import re
+import sys
+import os
+import memLoggerUtils
+import state_parser
+
+util = memLoggerUtils.MemLoggerUtil()
+
+#records decoded per read
+CHUNK_RECORDS = 4096
+#queues dumped by memLoggerDumpAllToFile within this many seconds share an epoch
+EPOCH_WINDOW = 2
+#FILE_TS_FORMAT "_%a_%b_%e_%H-%M-%S_%Y" in mem_logger.cpp
+FILE_TS = re.compile(r"_[A-Z][a-z]{2}_[A-Z][a-z]{2}_[ \d]?\d_\d\d-\d\d-\d\d_\d{4}")
+
+PAL_STATE = "PAL_STATE_Q"
+GRAPH = "GRAPH_Q"
+SPF_RESET = "SPF_RESET_Q"
+KPI = "KPI_Q"
+
+def queueType(inFile):
+    #same file name dispatch as memLoggerParser.parseBin, statbufs carry no timestamps
+    name = os.path.basename(inFile)
+    if "pal_state_queue" in name:
+        return PAL_STATE
+    elif "kpi_queue" in name:
+        return KPI
+    elif "graph" in name and "queue" in name:
+        return GRAPH
+    elif "spf_reset" in name and "queue" in name:
+        return SPF_RESET
+    return None
+
+def dumpTime(inFile):
+    match = FILE_TS.search(os.path.basename(inFile))
+    if not match:
+        return None
+    #%e pads single digit days with a space
+    stamp = match.group(0).replace(" ", "")
+    try:
+        return datetime.strptime(stamp, "_%a_%b_%d_%H-%M-%S_%Y")
+    except ValueError:
+        return None
+
+def groupEpochs(binFiles):
+    #cluster queue files whose dump times are close together
+    timed = []
+    for f in binFiles:
+        if queueType(f) is None:
+            continue
+        timed.append((dumpTime(f) or datetime.min, f))
+    timed.sort()
+
+    epochs = []
+    last = None
+    for when, f in timed:
+        if last is None or (when - last).total_seconds() > EPOCH_WINDOW:
+            epochs.append([])
+        epochs[-1].append(f)
+        last = when
+    return epochs
+
+def readRecords(inFile, qType):
+    #yields (timestamp, queue, record) from one bin file, CHUNK_RECORDS at a time
+    if qType == PAL_STATE:
+        FORMAT = util.getFormat("PAL_STATE_QUEUE")
+        recordSize = calcsize(FORMAT) + calcsize(util.getFormat("acd_info"))
+    elif qType == GRAPH:
+        FORMAT = util.getFormat("GRAPH_QUEUE")
+        recordSize = calcsize(FORMAT)
+    elif qType == SPF_RESET:
+        FORMAT = util.getFormat("SPF_RESET_QUEUE")
+        recordSize = calcsize(FORMAT)
+    else:
+        FORMAT = util.getFormat("KPI_QUEUE")
+        recordSize = calcsize(FORMAT)
+    #read the union as padding, only the base struct is needed here
+    recordFormat = FORMAT + str(recordSize - calcsize(FORMAT)) + "x"
+
+    with open(inFile, 'rb') as file:
+        while True:
+            chunk = file.read(recordSize * CHUNK_RECORDS)
+            usable = len(chunk) - len(chunk) % recordSize
+            if usable == 0:
+                break
+            for qItem in iter_unpack(recordFormat, chunk[:usable]):
+                yield (qItem[0], qType, qItem)
+
+class LatencyStats:
+    #running count/min/max/sum per transition name
+    def __init__(self):
+        self.stats = {}
+
+    def add(self, name, value):
+        s = self.stats.get(name)
+        if s is None:
+            self.stats[name] = [1, value, value, value]
+        else:
+            s[0] += 1
+            s[1] = min(s[1], value)
+            s[2] = max(s[2], value)
+            s[3] += value
+
+    def write(self):
+        for name in sorted(self.stats.keys()):
+            count, low, high, total = self.stats[name]
+            print(f'{name}')
+            print(f'\tcount {count} min {low} ms max {high} ms average {total / count:.1f} ms')
+
+class Correlator:
+    #tracks live streams by handle across the PAL state and graph queues
+    def __init__(self):
+        self.streams = {}
+        self.ssrDown = None
+        self.latency = LatencyStats()
+
+    def stream(self, handle):
+        s = self.streams.get(handle)
+        if s is None:
+            s = self.streams[handle] = {"type": None, "state": None, "since": {}}
+        return s
+
+    def onPalState(self, ts, qItem):
+        handle = qItem[state_parser.STREAM_HANDLE]
+        if qItem[state_parser.ERROR_CODE] != 0:
+            return
+        s = self.stream(handle)
+        state = util.getEnumToString("stream_state_t", qItem[state_parser.QUEUE_STATE])
+        s["type"] = util.getEnumToString("pal_stream_type_t", qItem[state_parser.STREAM_TYPE])
+        if s["state"] is not None and s["state"] in s["since"]:
+            self.latency.add(s["type"] + " " + s["state"] + " -> " + state,
+                             ts - s["since"][s["state"]])
+        if state == "STREAM_STARTED" and "STREAM_OPENED" in s["since"]:
+            self.latency.add(s["type"] + " STREAM_OPENED -> STREAM_STARTED (total)",
+                             ts - s["since"]["STREAM_OPENED"])
+        s["state"] = state
+        s["since"][state] = ts
+        if state == "STREAM_IDLE":
+            #closed, drop it so memory follows live streams only
+            del self.streams[handle]
+
+    def onGraph(self, ts, qItem):
+        timeStamp, state, result, handle = qItem
+        state = util.getEnumToString("graph_state", state)
+        if ctypes.c_int32(result).value != 0:
+            return
+        s = self.streams.get(handle)
+        if s is None or s["type"] is None:
+            return
+        #PAL state change to the matching graph operation on the same handle
+        palState = {"GRAPH_OPEN": "STREAM_OPENED", "GRAPH_START": "STREAM_STARTED",
+                    "GRAPH_STOP": "STREAM_STOPPED"}.get(state)
+        if palState and palState in s["since"]:
+            self.latency.add(s["type"] + " " + palState + " -> " + state,
+                             ts - s["since"][palState])
+
+    def onSPFReset(self, ts, qItem):
+        state = util.getEnumToString("spf_reset_state", qItem[1])
+        if state == "DOWN":
+            self.ssrDown = ts
+        elif state == "UP" and self.ssrDown is not None:
+            self.latency.add("SSR DOWN -> UP", ts - self.ssrDown)
+            self.ssrDown = None
+
+def writeRecord(ts, qType, qItem):
+    date = util.getTimeStamp(ts)
+    if qType == PAL_STATE:
+        line = (f'{hex(int(qItem[state_parser.STREAM_HANDLE]))} '
+                f'{util.getEnumToString("pal_stream_type_t", qItem[state_parser.STREAM_TYPE])} '
+                f'{util.getEnumToString("stream_state_t", qItem[state_parser.QUEUE_STATE])}')
+        if qItem[state_parser.ERROR_CODE] != 0:
+            line += f' FAILED {qItem[state_parser.ERROR_CODE]}'
+    elif qType == GRAPH:
+        timeStamp, state, result, handle = qItem
+        line = (f'{hex(int(handle))} {util.getEnumToString("graph_state", state)} '
+                f'{util.getEnumToString("exit_codes", -ctypes.c_int32(result).value)}')
+    elif qType == SPF_RESET:
+        line = f'{util.getEnumToString("spf_reset_state", qItem[1])}'
+    else:
+        timeStamp, pid, func_name, type = qItem
+        name = func_name.split(b"\0", 1)[0].decode("utf-8", "replace")
+        line = f'{pid} {name} {"exit" if type else "enter"}'
+    print(f'{date} {qType:<12}{line}')
+
+def parseTimeline(binFiles, display, outputDir, name):
+    original_stdout = sys.stdout # Save a reference to the original standard output
+    correlator = Correlator()
+
+    if not display:
+        path = os.path.join(outputDir, name + "_timeline.txt")
+        output = open(path, 'w')
+        sys.stdout = output
+
+    print(f'-----------------------------------------')
+    print(f'---------------TIMELINE------------------')
+    for f in binFiles:
+        print(f'  {os.path.basename(f)}')
+    print(f'-----------------------------------------')
+    #every queue is dumped oldest first, so a heap merge keeps global order
+    sources = [readRecords(f, queueType(f)) for f in binFiles]
+    for ts, qType, qItem in heapq.merge(*sources, key=lambda r: r[0]):
+        writeRecord(ts, qType, qItem)
+        if qType == PAL_STATE:
+            correlator.onPalState(ts, qItem)
+        elif qType == GRAPH:
+            correlator.onGraph(ts, qItem)
+        elif qType == SPF_RESET:
+            correlator.onSPFReset(ts, qItem)
+
+    print(f'-----------------------------------------')
+    print(f'-----------STREAM LATENCIES--------------')
+    correlator.latency.write()
+    print(f'-----------------------------------------')
+
+    if not display:
+        output.close()
+        sys.stdout = original_stdout
+        print('generating file ' + path)
+
+def main():
+    args = util.argparser()
+    # Get the current working directory
+    cwd = os.getcwd()
+    outputDir = os.path.join(cwd, util.createLogDir())
+    #get file path
+    full_path = os.path.realpath(__file__)
+    path, filename = os.path.split(full_path)
+    os.chdir(path)
+
+    binFiles = []
+    if os.path.isdir(args.fileName):
+        for filename in os.listdir(args.fileName):
+            f = os.path.join(args.fileName, filename)
+            if os.path.isfile(f):
+                binFiles.append(f)
+    elif os.path.isfile(args.fileName):
+        binFiles.append(args.fileName)
+
+    for epoch in groupEpochs(binFiles):
+        match = FILE_TS.search(os.path.basename(epoch[0]))
+        name = match.group(0).strip("_").replace(" ", "") if match else "memlogger"
+        parseTimeline(epoch, args.display, outputDir, name)
+
+
+if __name__ == "__main__":
+   main()